@@ -0,0 +1,67 @@
+/**
+ * @file  bench.h
+ *
+ * @brief Harness shared by the benchmarks that call the shell directly.
+ *
+ * The shell is built into the benchmark program, with its entry point renamed
+ * to yash_main(), so its functions and static state can be reached as they
+ * are. The results are written to `results`, a copy of stdout made before the
+ * benchmark redirects the output of the shell.
+ *
+ * Each line of results is a set of key=value pairs, to be easy to compare
+ * between builds.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#define main yash_main
+#include "../main.c"
+#undef main
+
+#define BENCH_NSEC 300000000L	//! Time spent on each CPU-bound benchmark
+
+static FILE* results;	//! Output of the benchmark results
+
+
+/**
+ * @brief Open the output of the benchmark results.
+ *
+ * The results are line buffered, so they are not lost or written twice by
+ * the children of the shell.
+ *
+ * @return	True on success, false on error (errno is set)
+ */
+static inline bool openResults() {
+	results = fdopen(dup(STDOUT_FILENO), "w");
+	if (!results) {
+		return (false);
+	}
+	setvbuf(results, NULL, _IOLBF, 0);
+	return (true);
+}
+
+
+/**
+ * @brief Compare two latencies, for qsort().
+ */
+static inline int cmpLatency(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Sort latencies, to read their percentiles.
+ *
+ * @param	lat	Latencies in nanoseconds
+ * @param	len	Number of latencies
+ */
+static inline void sortLatency(uint64_t lat[], size_t len) {
+	qsort(lat, len, sizeof(lat[0]), cmpLatency);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file  brace_expand.c
+ *
+ * @brief Benchmark of the lazy brace expansion.
+ *
+ * The expansion functions are called directly, @sa bench.h:
+ *
+ * - stream: words of a huge range generated one at a time, with the peak RSS
+ *   before and after, which should not grow.
+ * - argv: expandArgs() on a range that fits in ARG_MAX, as done by each child
+ *   right before exec().
+ * - reject: sizeArgs() on a range far over ARG_MAX, which stops as soon as
+ *   the limit is passed.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include "bench.h"
+
+#define BENCH_STREAM_WORD "part_{1..50000000}"	//! Word streamed
+#define BENCH_ARGV_WORD "part_{1..100000}"		//! Word expanded into argv
+#define BENCH_REJECT_WORD "part_{1..1000000000000}"	//! Word over ARG_MAX
+
+
+/**
+ * @brief Get the peak resident set size of this process.
+ *
+ * @return	Peak RSS in kilobytes
+ */
+static long maxRss() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_maxrss);
+}
+
+
+/**
+ * @brief Generate every word of a huge range.
+ */
+static void benchStream() {
+	char word[] = BENCH_STREAM_WORD;
+	char buf[MAX_BRACE_ITEM_LEN+1];
+	struct BraceGen gen;
+	uint64_t words = 0;
+	uint64_t bytes = 0;
+
+	long rss = maxRss();
+	uint64_t start = nowNs();
+	initBraces(&gen, word);
+	while (nextBrace(&gen, buf)) {
+		bytes += strlen(buf) + 1;
+		words++;
+	}
+	uint64_t elapsed = nowNs() - start;
+
+	fprintf(results, "bench=brace_stream words=%" PRIu64 " bytes=%" PRIu64
+			" words_per_s=%.0f rss_kb_before=%ld rss_kb_after=%ld\n", words, bytes,
+			words * 1e9 / elapsed, rss, maxRss());
+}
+
+
+/**
+ * @brief Expand a range into the arguments of a command.
+ */
+static void benchArgv() {
+	char word[] = BENCH_ARGV_WORD;
+	char* argv[] = { "touch", word, NULL };
+
+	uint64_t start = nowNs();
+	char** args = expandArgs(argv);
+	uint64_t elapsed = nowNs() - start;
+
+	size_t argc = 0;
+	while (args && args[argc]) {
+		argc++;
+	}
+	fprintf(results, "bench=brace_argv word=%s argc=%zu limit=%zu "
+			"expand_ms=%.2f\n", BENCH_ARGV_WORD, argc, argLimit(),
+			elapsed / 1e6);
+	free(args);
+}
+
+
+/**
+ * @brief Size a range far over ARG_MAX.
+ */
+static void benchReject() {
+	char word[] = BENCH_REJECT_WORD;
+	char* argv[] = { "touch", word, NULL };
+	size_t argc;
+	size_t bytes;
+
+	uint64_t start = nowNs();
+	bool fits = sizeArgs(argv, argLimit(), &argc, &bytes);
+	uint64_t elapsed = nowNs() - start;
+
+	fprintf(results, "bench=brace_reject word=%s fits=%d sized_argc=%zu "
+			"reject_ms=%.2f\n", BENCH_REJECT_WORD, fits, argc, elapsed / 1e6);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Exit status
+ */
+int main() {
+	if (!openResults()) {
+		perror("brace_expand");
+		return (EXIT_ERR);
+	}
+
+	benchStream();
+	benchArgv();
+	benchReject();
+	return (EXIT_OK);
+}
@@ -0,0 +1,138 @@
+/**
+ * @file  complete.c
+ *
+ * @brief Benchmark of the command completion index.
+ *
+ * A temporary directory with BENCH_EXECS executables is put first in PATH,
+ * and the shell functions are called directly, @sa bench.h:
+ *
+ * - build: first completion, which scans every PATH directory.
+ * - complete: completion of command name prefixes from the index.
+ * - refresh: time from a new executable showing up until it is completed,
+ *   updated from inotify by the event loop.
+ * - rescan: scan of the temporary directory alone, which the index saves on
+ *   each completion.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include "bench.h"
+
+#define BENCH_EXECS 20000		//! Executables in the temporary directory
+#define BENCH_COMPLETIONS 1000	//! Measured completions
+#define BENCH_REFRESHES 100		//! Measured refreshes
+#define BENCH_PREFIX "bench_cmd_"	//! Prefix of the executable names
+
+
+/**
+ * @brief Create an executable file.
+ *
+ * @param	dir		Directory of the file
+ * @param	name	File name
+ */
+static void createExec(const char* dir, const char* name) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU);
+	if (fd == SYSCALL_RETURN_ERR) {
+		perror("open");
+		exit(EXIT_ERR);
+	}
+	close(fd);
+}
+
+
+/**
+ * @brief Count the completions of a prefix.
+ *
+ * @param	prefix	Command name prefix
+ * @return	Number of matches
+ */
+static int complete(const char* prefix) {
+	char** matches = rl_completion_matches(prefix, completeExecName);
+	int len = 0;
+	if (matches) {
+		while (matches[len]) {
+			free(matches[len++]);
+		}
+		free(matches);
+	}
+	return (len > 1 ? len - 1 : len);	// Skip the common prefix entry
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Exit status
+ */
+int main() {
+	static uint64_t lat[BENCH_COMPLETIONS];
+	char dir[] = "/tmp/yash_complete_XXXXXX";
+	char name[NAME_MAX+1];
+	char path[PATH_MAX*2];
+
+	if (!openResults() || !mkdtemp(dir) || !initEvents()) {
+		perror("complete");
+		return (EXIT_ERR);
+	}
+	for (int i=0; i<BENCH_EXECS; i++) {
+		snprintf(name, sizeof(name), BENCH_PREFIX "%d", i);
+		createExec(dir, name);
+	}
+	snprintf(path, sizeof(path), "%s:%s", dir, getenv("PATH"));
+	setenv("PATH", path, 1);
+
+	// First use
+	uint64_t start = nowNs();
+	int found = complete(BENCH_PREFIX "1234");
+	uint64_t build = nowNs() - start;
+	fprintf(results, "bench=complete_build dirs=%d names=%zu build_ms=%.2f\n",
+			exec_dirs_len, exec_names_len, build / 1e6);
+
+	// Completions of prefixes with 1 to 11 matches
+	for (int i=0; i<BENCH_COMPLETIONS; i++) {
+		snprintf(name, sizeof(name), BENCH_PREFIX "%d",
+				(i * 7919) % (BENCH_EXECS / 10) + BENCH_EXECS / 10);
+		uint64_t t0 = nowNs();
+		found += complete(name);
+		lat[i] = nowNs() - t0;
+	}
+	sortLatency(lat, BENCH_COMPLETIONS);
+	fprintf(results, "bench=complete runs=%d matches=%d p50_us=%.1f "
+			"p99_us=%.1f\n", BENCH_COMPLETIONS, found,
+			lat[BENCH_COMPLETIONS/2] / 1e3, lat[BENCH_COMPLETIONS*99/100] / 1e3);
+
+	// New executables picked up by the event loop
+	for (int i=0; i<BENCH_REFRESHES; i++) {
+		snprintf(name, sizeof(name), "new_cmd_%d", i);
+		createExec(dir, name);
+		uint64_t t0 = nowNs();
+		while (runEvents(0) && complete(name) == 0);
+		lat[i] = nowNs() - t0;
+	}
+	sortLatency(lat, BENCH_REFRESHES);
+	fprintf(results, "bench=complete_refresh runs=%d p50_us=%.1f p99_us=%.1f\n",
+			BENCH_REFRESHES, lat[BENCH_REFRESHES/2] / 1e3,
+			lat[BENCH_REFRESHES*99/100] / 1e3);
+
+	// What each completion would cost without the index
+	start = nowNs();
+	scanExecDir(&exec_dirs[0]);
+	fprintf(results, "bench=complete_rescan names=%zu rescan_ms=%.2f\n",
+			exec_dirs[0].len, (nowNs() - start) / 1e6);
+
+	// Clean up
+	DIR* d = opendir(dir);
+	struct dirent* ent;
+	while (d && (ent = readdir(d))) {
+		if (ent->d_name[0] != '.') {
+			unlinkat(dirfd(d), ent->d_name, 0);
+		}
+	}
+	if (d) {
+		closedir(d);
+	}
+	rmdir(dir);
+	return (EXIT_OK);
+}
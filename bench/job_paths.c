@@ -0,0 +1,268 @@
+/**
+ * @file  job_paths.c
+ *
+ * @brief Micro-benchmarks of the parse, spawn, pipeline and reaping paths.
+ *
+ * The functions of each path are called directly, without a terminal or
+ * readline in the way, @sa bench.h:
+ *
+ * - tokenize: tokenizeString() on a line of MAX_CMD_LEN characters.
+ * - parse: parseJob() on a line with redirections and a pipe.
+ * - redirect: redirectSimple() with input, output and error redirected.
+ * - spawn: foreground simple and piped jobs run by handleNewJob().
+ * - pipe: throughput of a foreground pipeline moving BENCH_PIPE_BYTES.
+ * - reap: maintainJobsTable() with N background jobs running, both when no
+ *   job finished (scan) and from the exit of a job to its removal (reap).
+ *
+ * The output of the shell itself is sent to /dev/null.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include "bench.h"
+
+#define BENCH_SPAWNS 300		//! Jobs run by each spawn benchmark
+#define BENCH_REAPS 100			//! Jobs reaped for each number of jobs
+#define BENCH_PIPE_BYTES "268435456"	//! Bytes moved by the pipe benchmark
+#define BENCH_SLEEP_JOB "sleep 600 &"	//! Job kept running by reap benchmark
+#define BENCH_WAIT_MSEC 10		//! Max wait for job state changes
+
+
+/**
+ * @brief Tokenize a line of MAX_CMD_LEN characters over and over.
+ */
+static void benchTokenize() {
+	static struct Job job;
+	char line[MAX_CMD_LEN+1];
+	uint64_t lines = 0;
+	uint64_t tokens = 0;
+
+	// Two characters per token, up to the max number of tokens
+	int len = 0;
+	for (int i=0; i<MAX_TOKEN_NUM-1 && len+2<=MAX_CMD_LEN; i++) {
+		line[len++] = 'a' + i % 26;
+		line[len++] = ' ';
+	}
+	line[len] = '\0';
+
+	uint64_t start = nowNs();
+	uint64_t elapsed;
+	do {
+		strcpy(job.cmd_str, line);
+		tokenizeString(&job);
+		tokens += job.cmd_tok_len;
+		lines++;
+	} while ((elapsed = nowNs() - start) < BENCH_NSEC);
+
+	fprintf(results, "bench=tokenize line_len=%d tokens_per_line=%u "
+			"lines_per_s=%.0f tokens_per_s=%.0f\n", len, job.cmd_tok_len,
+			lines * 1e9 / elapsed, tokens * 1e9 / elapsed);
+}
+
+
+/**
+ * @brief Parse a job with redirections and a pipe over and over.
+ */
+static void benchParse() {
+	char line[] = "grep -v x < in.txt 2> err.txt | sort -r > out.txt";
+	static struct Job jobs[1];
+	int idx = 0;
+	uint64_t parses = 0;
+
+	uint64_t start = nowNs();
+	uint64_t elapsed;
+	do {
+		memset(&jobs[0], 0, sizeof(jobs[0]));
+		jobs[0].here1_fd = NO_FD;
+		jobs[0].here2_fd = NO_FD;
+		parseJob(line, jobs, &idx);
+		parses++;
+	} while ((elapsed = nowNs() - start) < BENCH_NSEC);
+
+	if (strcmp(jobs[0].err_msg, EMPTY_STR)) {
+		fprintf(stderr, "parse: %s\n", jobs[0].err_msg);
+		exit(EXIT_ERR);
+	}
+	fprintf(results, "bench=parse tokens=%u jobs_per_s=%.0f ns_per_job=%.0f\n",
+			jobs[0].cmd_tok_len, parses * 1e9 / elapsed,
+			(double)elapsed / parses);
+}
+
+
+/**
+ * @brief Set and undo the redirections of a simple command over and over.
+ */
+static void benchRedirect() {
+	static struct Job job;
+	int saved_fds[STD_FDS];
+	uint64_t redirs = 0;
+
+	job.here1_fd = NO_FD;
+	strcpy(job.in1, DEV_NULL);
+	strcpy(job.out1, DEV_NULL);
+	strcpy(job.err1, DEV_NULL);
+	for (int i=0; i<STD_FDS; i++) {
+		saved_fds[i] = dup(i);
+	}
+
+	uint64_t start = nowNs();
+	uint64_t elapsed;
+	do {
+		redirectSimple(&job);
+		for (int i=0; i<STD_FDS; i++) {
+			dup2(saved_fds[i], i);
+		}
+		redirs++;
+	} while ((elapsed = nowNs() - start) < BENCH_NSEC);
+
+	for (int i=0; i<STD_FDS; i++) {
+		close(saved_fds[i]);
+	}
+	if (strcmp(job.err_msg, EMPTY_STR)) {
+		fprintf(stderr, "redirect: %s\n", job.err_msg);
+		exit(EXIT_ERR);
+	}
+	fprintf(results, "bench=redirect fds=%d redirs_per_s=%.0f "
+			"ns_per_redir=%.0f\n", STD_FDS, redirs * 1e9 / elapsed,
+			(double)elapsed / redirs);
+}
+
+
+/**
+ * @brief Run a foreground job over and over.
+ *
+ * @param	name	Name of the benchmark
+ * @param	cmd		Command line of the job
+ */
+static void benchSpawn(const char* name, const char* cmd) {
+	static uint64_t lat[BENCH_SPAWNS];
+	char line[MAX_CMD_LEN+1];
+
+	uint64_t start = nowNs();
+	for (int i=0; i<BENCH_SPAWNS; i++) {
+		strcpy(line, cmd);
+		uint64_t t0 = nowNs();
+		handleNewJob(line, false);
+		lat[i] = nowNs() - t0;
+		if (last_status != EXIT_OK) {
+			fprintf(stderr, "%s: job failed: %d\n", name, last_status);
+			exit(EXIT_ERR);
+		}
+	}
+	uint64_t elapsed = nowNs() - start;
+
+	sortLatency(lat, BENCH_SPAWNS);
+	fprintf(results, "bench=spawn mode=%s runs=%d jobs_per_s=%.0f "
+			"p50_us=%.1f p99_us=%.1f\n", name, BENCH_SPAWNS,
+			BENCH_SPAWNS * 1e9 / elapsed, lat[BENCH_SPAWNS/2] / 1e3,
+			lat[BENCH_SPAWNS*99/100] / 1e3);
+}
+
+
+/**
+ * @brief Move data through the pipe of a foreground job.
+ */
+static void benchPipe() {
+	char line[] = "head -c " BENCH_PIPE_BYTES " /dev/zero | cat > " DEV_NULL;
+	double bytes = atof(BENCH_PIPE_BYTES);
+
+	uint64_t start = nowNs();
+	handleNewJob(line, false);
+	uint64_t elapsed = nowNs() - start;
+
+	if (last_status != EXIT_OK) {
+		fprintf(stderr, "pipe: job failed: %d\n", last_status);
+		exit(EXIT_ERR);
+	}
+	fprintf(results, "bench=pipe bytes=%s mib_per_s=%.0f\n", BENCH_PIPE_BYTES,
+			bytes * 1e9 / elapsed / (1 << 20));
+}
+
+
+/**
+ * @brief Reap background jobs while other background jobs keep running.
+ *
+ * @param	running	Number of background jobs kept running
+ */
+static void benchReap(int running) {
+	static uint64_t scan[BENCH_REAPS];
+	static uint64_t reap[BENCH_REAPS];
+	char line[MAX_CMD_LEN+1];
+
+	for (int i=0; i<running; i++) {
+		strcpy(line, BENCH_SLEEP_JOB);
+		if (handleNewJob(line, false) == EMPTY_ARRAY) {
+			fprintf(stderr, "reap: could not start job %d\n", i);
+			exit(EXIT_ERR);
+		}
+	}
+
+	for (int i=0; i<BENCH_REAPS; i++) {
+		strcpy(line, "true &");
+		int idx = handleNewJob(line, false);
+		if (idx == EMPTY_ARRAY) {
+			fprintf(stderr, "reap: could not start job\n");
+			exit(EXIT_ERR);
+		}
+
+		// Table scan with nothing to reap yet
+		uint64_t t0 = nowNs();
+		maintainJobsTable();
+		scan[i] = nowNs() - t0;
+
+		// From the exit of the job to its removal from the table
+		struct pollfd pfd = { job_arr[idx].procs[0].pidfd, POLLIN, 0 };
+		poll(&pfd, 1, -1);
+		t0 = nowNs();
+		while (job_arr[idx].child_count > 0) {
+			maintainJobsTable();
+		}
+		reap[i] = nowNs() - t0;
+		runEvents(0);	// Drain the SIGCHLD notifications
+	}
+
+	// Leave an empty table for the next run
+	killAllJobs();
+	for (int i=0; i<=last_job; i++) {
+		while (job_arr[i].jobno > 0 && job_arr[i].child_count > 0) {
+			runEvents(BENCH_WAIT_MSEC);
+			maintainJobsTable();
+		}
+	}
+
+	sortLatency(scan, BENCH_REAPS);
+	sortLatency(reap, BENCH_REAPS);
+	fprintf(results, "bench=reap running=%d runs=%d scan_p50_ns=%" PRIu64
+			" reap_p50_ns=%" PRIu64 " reap_p99_ns=%" PRIu64 "\n", running,
+			BENCH_REAPS,
+			scan[BENCH_REAPS/2], reap[BENCH_REAPS/2],
+			reap[BENCH_REAPS*99/100]);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Exit status
+ */
+int main() {
+	// Keep the results apart from the output of the shell
+	int null = open(DEV_NULL, O_WRONLY);
+	if (!openResults() || null == SYSCALL_RETURN_ERR || !initEvents()) {
+		perror("job_paths");
+		return (EXIT_ERR);
+	}
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	benchTokenize();
+	benchParse();
+	benchRedirect();
+	benchSpawn("simple", "true");
+	benchSpawn("piped", "true | true");
+	benchPipe();
+	benchReap(0);
+	benchReap(MAX_CONCURRENT_JOBS / 4);
+	benchReap(MAX_CONCURRENT_JOBS - 1);
+	return (EXIT_OK);
+}
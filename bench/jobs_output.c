@@ -0,0 +1,118 @@
+/**
+ * @file  jobs_output.c
+ *
+ * @brief Benchmark of the shell output while listing a full jobs table.
+ *
+ * The jobs table is filled with sleeping background jobs, and `jobs` is run
+ * over and over, with stdout sent to a pseudo-terminal, like in an interactive
+ * shell. Each listing is run with stdout:
+ *
+ * - batched: fully buffered, and flushed once per listing like between two
+ *   prompts, @sa flushOutput().
+ * - line: line buffered, like stdio does for a terminal by default.
+ *
+ * stdout writes through a counter, so the write() calls of each listing are
+ * counted too.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include "bench.h"
+
+#include <pty.h>
+
+#define BENCH_LISTINGS 2000		//! Measured listings for each mode
+#define BENCH_JOB "sleep 600 &"	//! Job kept running in the table
+
+static uint64_t writes;	//! Writes to stdout
+
+
+/**
+ * @brief Write to the pseudo-terminal, and count the write.
+ *
+ * @param	cookie	Descriptor of the pseudo-terminal
+ * @param	buf		Data to write
+ * @param	size	Length of the data
+ * @return	Bytes written
+ */
+static ssize_t countWrite(void* cookie, const char* buf, size_t size) {
+	writes++;
+	return (write(*(int*)cookie, buf, size));
+}
+
+
+/**
+ * @brief Read everything written to the pseudo-terminal so far.
+ *
+ * @param	master	Master side of the pseudo-terminal, non-blocking
+ */
+static void drain(int master) {
+	char buf[BUFSIZ];
+	while (read(master, buf, sizeof(buf)) > 0);
+}
+
+
+/**
+ * @brief List the jobs table over and over.
+ *
+ * @param	name	Name of the mode
+ * @param	mode	Buffering mode of stdout
+ * @param	master	Master side of the pseudo-terminal
+ */
+static void benchJobs(const char* name, int mode, int master) {
+	char* argv[] = { CMD_JOBS, NULL };
+
+	setvbuf(stdout, mode == _IOFBF ? out_buf : NULL, mode, OUT_BUF_LEN);
+	writes = 0;
+
+	uint64_t elapsed = 0;
+	for (int i=0; i<BENCH_LISTINGS; i++) {
+		uint64_t t0 = nowNs();
+		jobsExec(1, argv);
+		flushOutput();
+		elapsed += nowNs() - t0;
+		drain(master);
+	}
+
+	fprintf(results, "bench=jobs_output mode=%s jobs=%d listings=%d "
+			"writes_per_listing=%.1f us_per_listing=%.1f\n", name, last_job + 1,
+			BENCH_LISTINGS, (double)writes / BENCH_LISTINGS,
+			elapsed / 1e3 / BENCH_LISTINGS);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Exit status
+ */
+int main() {
+	char line[MAX_CMD_LEN+1];
+	int master;
+	int slave;
+
+	if (!openResults() || openpty(&master, &slave, NULL, NULL, NULL) ==
+			SYSCALL_RETURN_ERR || !initEvents()) {
+		perror("jobs_output");
+		return (EXIT_ERR);
+	}
+	fcntl(master, F_SETFL, O_NONBLOCK);
+	cookie_io_functions_t io = { NULL, countWrite, NULL, NULL };
+	stdout = fopencookie(&slave, "w", io);
+
+	for (int i=0; i<MAX_CONCURRENT_JOBS-1; i++) {
+		strcpy(line, BENCH_JOB);
+		if (handleNewJob(line, false) == EMPTY_ARRAY) {
+			fprintf(stderr, "jobs_output: could not start job %d\n", i);
+			return (EXIT_ERR);
+		}
+	}
+
+	benchJobs("batched", _IOFBF, master);
+	benchJobs("line", _IOLBF, master);
+
+	killAllJobs();
+	flushOutput();
+	drain(master);
+	return (EXIT_OK);
+}
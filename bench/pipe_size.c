@@ -0,0 +1,139 @@
+/**
+ * @file  pipe_size.c
+ *
+ * @brief Benchmark of pipe throughput versus pipe buffer size.
+ *
+ * A producer process writes BENCH_BYTES through a pipe to a consumer process,
+ * for each buffer size in BENCH_SIZES. Both use small reads and writes, like a
+ * decompress | parse pipeline, so small buffers force many context switches.
+ *
+ * Each line of output is a set of key=value pairs, to be easy to compare
+ * between builds.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#define _GNU_SOURCE	// F_SETPIPE_SZ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define BENCH_BYTES (512L*1024*1024)	//! Bytes sent for each buffer size
+#define BENCH_CHUNK 4096				//! Size of each read and write
+#define SYSCALL_RETURN_ERR -1			//! Value returned on a system call error
+
+static const int BENCH_SIZES[] = {	//! Pipe buffer sizes to test
+		4096, 16384, 65536, 262144, 1048576
+};
+static long last_csw;	//! Context switches of the children in previous runs
+
+
+/**
+ * @brief Write BENCH_BYTES to a file descriptor.
+ *
+ * @param	fd	File descriptor to write to
+ */
+static void produce(int fd) {
+	char chunk[BENCH_CHUNK];
+	memset(chunk, 'y', sizeof(chunk));
+
+	for (long sent=0; sent<BENCH_BYTES; sent+=sizeof(chunk)) {
+		if (write(fd, chunk, sizeof(chunk)) == SYSCALL_RETURN_ERR) {
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+/**
+ * @brief Read a file descriptor until EOF, touching every byte read.
+ *
+ * @param	fd	File descriptor to read from
+ * @return	Sum of all the bytes read
+ */
+static uint64_t consume(int fd) {
+	char chunk[BENCH_CHUNK];
+	uint64_t sum = 0;
+	ssize_t n;
+
+	while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+		for (ssize_t i=0; i<n; i++) {
+			sum += chunk[i];
+		}
+	}
+	return sum;
+}
+
+
+/**
+ * @brief Run the producer and consumer through a pipe of the given size.
+ *
+ * @param	size	Pipe buffer size
+ */
+static void runBench(int size) {
+	struct timespec start, end;
+	struct rusage usage;
+	int pfd[2];
+
+	if (pipe(pfd) == SYSCALL_RETURN_ERR) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+	int actual = fcntl(pfd[1], F_SETPIPE_SZ, size);
+	if (actual == SYSCALL_RETURN_ERR) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t producer = fork();
+	if (producer == 0) {
+		close(pfd[0]);
+		produce(pfd[1]);
+		_exit(EXIT_SUCCESS);
+	}
+	pid_t consumer = fork();
+	if (consumer == 0) {
+		close(pfd[1]);
+		consume(pfd[0]);
+		_exit(EXIT_SUCCESS);
+	}
+	close(pfd[0]);
+	close(pfd[1]);
+	waitpid(producer, NULL, 0);
+	waitpid(consumer, NULL, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// Context switches of both children
+	getrusage(RUSAGE_CHILDREN, &usage);
+	long csw = usage.ru_nvcsw + usage.ru_nivcsw;
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("bench=pipe_size pipe_size=%d bytes=%ld seconds=%.6f mb_per_s=%.1f"
+			" context_switches=%ld\n", actual, BENCH_BYTES, secs,
+			BENCH_BYTES / secs / (1024*1024), csw - last_csw);
+	fflush(stdout);
+	last_csw = csw;
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Errorcode
+ */
+int main() {
+	for (size_t i=0; i<sizeof(BENCH_SIZES)/sizeof(BENCH_SIZES[0]); i++) {
+		runBench(BENCH_SIZES[i]);
+	}
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file  plan_cache.c
+ *
+ * @brief Benchmark of the plan cache on a script with many repeated lines.
+ *
+ * The script has BENCH_LINES lines, taken from a few lines with redirections
+ * and pipes, and one unique line out of each BENCH_UNIQUE. Each line is turned
+ * into a job by planJob(), which is then removed without running it, so only
+ * the cost of parsing is measured:
+ *
+ * - plancache=on: repeated lines are loaded from the plan cache.
+ * - plancache=off: every line is tokenized and parsed from scratch.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include "bench.h"
+
+#define BENCH_LINES 1000		//! Lines of the script
+#define BENCH_UNIQUE 10			//! One out of this many lines is unique
+
+static const char* repeated[] = {	//! Lines repeated across the script
+	"ls -l",
+	"grep -v x < in.txt 2> err.txt | sort -r > out.txt",
+	"cat /etc/hostname | tr a-z A-Z",
+	"echo building target > log.txt",
+	"make -j 4 all 2>> err.txt",
+	"find . -name main.c | wc -l",
+	"sleep 1 &",
+	"git status --short | head -n 20 > status.txt",
+};
+
+
+/**
+ * @brief Turn every line of the script into a job over and over.
+ *
+ * @param	script	Lines of the script
+ * @param	cache	Use the plan cache
+ */
+static void benchScript(char script[][MAX_CMD_LEN+1], bool cache) {
+	char line[MAX_CMD_LEN+1];
+	uint64_t lines = 0;
+
+	shell_opts[OPT_PLANCACHE].value = cache;
+	memset(plan_cache, 0, sizeof(plan_cache));
+	plan_hits = 0;
+	plan_misses = 0;
+
+	uint64_t start = nowNs();
+	uint64_t elapsed;
+	do {
+		for (int i=0; i<BENCH_LINES; i++) {
+			strcpy(line, script[i]);
+			int idx = findFreeJob();
+			last_job = idx > last_job ? idx : last_job;
+			if (!planJob(line, idx)) {
+				fprintf(stderr, "plan_cache: %s\n", job_arr[idx].err_msg);
+				exit(EXIT_ERR);
+			}
+			job_arr[idx].jobno = idx + 1;
+			removeJob(idx);
+		}
+		lines += BENCH_LINES;
+	} while ((elapsed = nowNs() - start) < BENCH_NSEC);
+
+	fprintf(results, "bench=plan_cache plancache=%s lines=%" PRIu64
+			" lines_per_s=%.0f ns_per_line=%.0f hit_rate=%.1f\n",
+			cache ? "on" : "off", lines, lines * 1e9 / elapsed,
+			(double)elapsed / lines, plan_hits + plan_misses ?
+			100.0 * plan_hits / (plan_hits + plan_misses) : 0.0);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @return	Exit status
+ */
+int main() {
+	static char script[BENCH_LINES][MAX_CMD_LEN+1];
+	int len = sizeof(repeated) / sizeof(repeated[0]);
+
+	if (!openResults()) {
+		perror("plan_cache");
+		return (EXIT_ERR);
+	}
+
+	// The unique lines vary by an argument
+	for (int i=0; i<BENCH_LINES; i++) {
+		if (i % BENCH_UNIQUE == 0) {
+			snprintf(script[i], sizeof(script[i]), "echo line %d > out.txt", i);
+		} else {
+			snprintf(script[i], sizeof(script[i]), "%s", repeated[i % len]);
+		}
+	}
+
+	benchScript(script, true);
+	benchScript(script, false);
+	return (EXIT_OK);
+}
@@ -0,0 +1,348 @@
+/**
+ * @file  prompt_latency.c
+ *
+ * @brief Benchmark of the time from a keystroke to the next prompt.
+ *
+ * The benchmark runs yash under a pseudo-terminal, the way users run it, and
+ * plays scripted sessions. Each command line is typed, and once it is echoed,
+ * Enter is pressed and the clock runs until readline prints the next prompt.
+ * The sessions are:
+ *
+ * - simple: a command that exits right away.
+ * - pipeline: two commands connected by a pipe.
+ * - bg: a job sent to the background with `&`.
+ * - ctrl_z: Ctrl-Z on a running foreground job, measured from the keystroke.
+ * - ctrl_c: Ctrl-C on a running foreground job, measured from the keystroke.
+ *
+ * Every session runs first with an empty jobs table, and then again with the
+ * table full of sleeping background jobs, to stress the job maintenance done
+ * before each prompt.
+ *
+ * Each line of output is a set of key=value pairs, to be easy to compare
+ * between builds. It needs no terminal, so it runs headless.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BENCH_RUNS 200		//! Measured command lines per session
+#define BENCH_SIGNAL_RUNS 50	//! Measured Ctrl-Z or Ctrl-C per session
+#define BENCH_WARMUP 10		//! Command lines run before measuring
+#define BENCH_JOBS 18		//! Jobs kept running on stress, leaves room in the table
+#define BENCH_TIMEOUT_MSEC 10000	//! Max wait for the shell output
+#define BENCH_POLL_USEC 100	//! Sleep between checks of the foreground job
+#define PROMPT "# "			//! Prompt printed by yash
+#define CTRL_C "\x03"		//! Ctrl-C keystroke
+#define CTRL_D "\x04"		//! Ctrl-D keystroke
+#define CTRL_Z "\x1a"		//! Ctrl-Z keystroke
+#define ENTER "\r"			//! Enter keystroke
+#define BUF_LEN 4096		//! Output buffer length
+#define SYSCALL_RETURN_ERR -1	//! Value returned on a system call error
+
+/**
+ * @brief Session run by the benchmark.
+ */
+struct Session {
+	const char* name;	//! Name of the session to print
+	const char* cmd;	//! Command line typed
+	const char* key;	//! Keystroke sent once the job runs, or NULL
+	int runs;			//! Measured command lines
+};
+
+static const struct Session sessions[] = {	//! Sessions to benchmark
+	{ "simple", "true", NULL, BENCH_RUNS },
+	{ "pipeline", "echo x | cat", NULL, BENCH_RUNS },
+	{ "bg", "true &", NULL, BENCH_RUNS },
+	{ "ctrl_z", "sleep 600", CTRL_Z, BENCH_SIGNAL_RUNS },
+	{ "ctrl_c", "sleep 600", CTRL_C, BENCH_SIGNAL_RUNS },
+};
+
+
+/**
+ * @brief Get the time from a monotonic clock.
+ *
+ * @return	Time in nanoseconds
+ */
+static uint64_t nowNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000L + now.tv_nsec);
+}
+
+
+/**
+ * @brief Compare two latencies, for qsort().
+ */
+static int cmpLatency(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Send keystrokes to the terminal.
+ *
+ * @param	master	Master side of the pseudo-terminal
+ * @param	keys	Keystrokes to send
+ */
+static void sendKeys(int master, const char* keys) {
+	if (write(master, keys, strlen(keys)) != strlen(keys)) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/**
+ * @brief Read the terminal output until it shows the given text.
+ *
+ * @param	master	Master side of the pseudo-terminal
+ * @param	text	Text to look for
+ * @param	at_end	Look for the text at the end of the output only
+ */
+static void readUntil(int master, const char* text, bool at_end) {
+	char buf[BUF_LEN];
+	size_t len = 0;
+	size_t text_len = strlen(text);
+
+	for (;;) {
+		struct pollfd pfd = { master, POLLIN, 0 };
+		if (poll(&pfd, 1, BENCH_TIMEOUT_MSEC) <= 0) {
+			fprintf(stderr, "timeout waiting for \"%s\"\n", text);
+			exit(EXIT_FAILURE);
+		}
+		ssize_t n = read(master, &buf[len], sizeof(buf) - len - 1);
+		if (n <= 0) {
+			fprintf(stderr, "yash exited\n");
+			exit(EXIT_FAILURE);
+		}
+		len += n;
+		buf[len] = '\0';
+
+		if (at_end ? len >= text_len && !strcmp(&buf[len-text_len], text) :
+				strstr(buf, text) != NULL) {
+			return;
+		}
+
+		// Keep the tail, where the text may start
+		if (len > sizeof(buf) / 2) {
+			memmove(buf, &buf[len-text_len], text_len + 1);
+			len = text_len;
+		}
+	}
+}
+
+
+/**
+ * @brief Wait until a job owns the terminal, and runs the given program.
+ *
+ * The job takes the terminal before exec(), while it still ignores the
+ * keyboard signals like the shell, so its program name is checked as well.
+ *
+ * @param	master	Master side of the pseudo-terminal
+ * @param	shell	Process group of the shell
+ * @param	prog	Program name of the job
+ * @return	Process group of the job
+ */
+static pid_t waitForeground(int master, pid_t shell, const char* prog) {
+	uint64_t deadline = nowNs() + BENCH_TIMEOUT_MSEC * 1000000L;
+	char path[PATH_MAX];
+	char comm[NAME_MAX+1];
+	pid_t pgid;
+
+	for (;;) {
+		pgid = tcgetpgrp(master);
+		if (pgid != shell && pgid != SYSCALL_RETURN_ERR) {
+			snprintf(path, sizeof(path), "/proc/%d/comm", pgid);
+			FILE* f = fopen(path, "r");
+			bool running = f && fgets(comm, sizeof(comm), f) &&
+					!strncmp(comm, prog, strcspn(prog, " ")) &&
+					comm[strcspn(prog, " ")] == '\n';
+			if (f) {
+				fclose(f);
+			}
+			if (running) {
+				return (pgid);
+			}
+		}
+		if (nowNs() > deadline) {
+			fprintf(stderr, "timeout waiting for the foreground job\n");
+			exit(EXIT_FAILURE);
+		}
+		usleep(BENCH_POLL_USEC);
+	}
+}
+
+
+/**
+ * @brief Kill a stopped job, and wait until its process can be reaped.
+ *
+ * yash reaps jobs after each command line, so the next line must not start
+ * before the job is gone, or it could find the jobs table full.
+ *
+ * @param	pgid	Process group of the job, the PID of its process
+ */
+static void killJob(pid_t pgid) {
+	uint64_t deadline = nowNs() + BENCH_TIMEOUT_MSEC * 1000000L;
+	char path[PATH_MAX];
+	char stat[BUF_LEN];
+
+	killpg(pgid, SIGKILL);
+	snprintf(path, sizeof(path), "/proc/%d/stat", pgid);
+	for (;;) {
+		FILE* f = fopen(path, "r");
+		if (!f) {	// Already reaped
+			return;
+		}
+		char* state = fgets(stat, sizeof(stat), f) ? strrchr(stat, ')') : NULL;
+		fclose(f);
+		if (state && state[1] == ' ' && state[2] == 'Z') {
+			return;
+		}
+		if (nowNs() > deadline) {
+			fprintf(stderr, "timeout waiting for job %d to exit\n", pgid);
+			exit(EXIT_FAILURE);
+		}
+		usleep(BENCH_POLL_USEC);
+	}
+}
+
+
+/**
+ * @brief Type a command line and measure the time to the next prompt.
+ *
+ * @param	master	Master side of the pseudo-terminal
+ * @param	shell	Process group of the shell
+ * @param	session	Session to play
+ * @return	Latency in nanoseconds
+ */
+static uint64_t runLine(int master, pid_t shell, const struct Session* session) {
+	// Type the line, and wait for the echo before pressing Enter
+	sendKeys(master, session->cmd);
+	readUntil(master, session->cmd, false);
+	uint64_t start = nowNs();
+	sendKeys(master, ENTER);
+
+	// Interrupt or stop the job once it owns the terminal
+	pid_t job = 0;
+	if (session->key) {
+		job = waitForeground(master, shell, session->cmd);
+		start = nowNs();
+		sendKeys(master, session->key);
+	}
+	readUntil(master, PROMPT, true);
+	uint64_t latency = nowNs() - start;
+
+	// Stopped jobs cannot be resumed from yash, so get rid of them
+	if (job > 0) {
+		killJob(job);
+	}
+	return (latency);
+}
+
+
+/**
+ * @brief Run yash under a pseudo-terminal, and play one session.
+ *
+ * @param	yash	Path to the yash executable
+ * @param	session	Session to play
+ * @param	jobs	Background jobs kept running during the session
+ */
+static void runSession(char* yash, const struct Session* session, int jobs) {
+	static uint64_t latency[BENCH_RUNS];
+	struct winsize ws = { 24, 80, 0, 0 };
+	int master;
+
+	pid_t pid = forkpty(&master, NULL, NULL, &ws);
+	if (pid == SYSCALL_RETURN_ERR) {
+		perror("forkpty");
+		exit(EXIT_FAILURE);
+	} else if (pid == 0) {
+		execl(yash, yash, (char*)NULL);
+		perror("execl");
+		_exit(EXIT_FAILURE);
+	}
+	readUntil(master, PROMPT, true);
+
+	// Fill the jobs table
+	for (int i=0; i<jobs; i++) {
+		sendKeys(master, "sleep 600 &" ENTER);
+		readUntil(master, PROMPT, true);
+	}
+
+	for (int i=0; i<BENCH_WARMUP+session->runs; i++) {
+		uint64_t t = runLine(master, pid, session);
+		if (i >= BENCH_WARMUP) {
+			latency[i-BENCH_WARMUP] = t;
+		}
+	}
+
+	// Exit, yash terminates the jobs left
+	sendKeys(master, CTRL_D);
+	waitpid(pid, NULL, 0);
+	close(master);
+
+	// Print the latency distribution
+	int runs = session->runs;
+	uint64_t sum = 0;
+	for (int i=0; i<runs; i++) {
+		sum += latency[i];
+	}
+	qsort(latency, runs, sizeof(latency[0]), cmpLatency);
+	printf("bench=prompt_latency session=%s jobs=%d runs=%d mean_us=%.1f"
+			" p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n", session->name,
+			jobs, runs, sum / 1000.0 / runs, latency[runs/2] / 1000.0,
+			latency[runs*9/10] / 1000.0, latency[runs*99/100] / 1000.0,
+			latency[runs-1] / 1000.0);
+	fflush(stdout);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * Usage: `prompt_latency [path/to/yash]`. By default yash is looked for in the
+ * parent folder of this program.
+ *
+ * @param argc	Number of command line arguments
+ * @param argv	Array of command line arguments
+ * @return	Errorcode
+ */
+int main(int argc, char** argv) {
+	char self[PATH_MAX];
+	char yash[PATH_MAX];
+
+	if (!realpath(argv[0], self)) {
+		perror("realpath");
+		return (EXIT_FAILURE);
+	}
+	if (argc > 1) {
+		snprintf(yash, sizeof(yash), "%s", argv[1]);
+	} else {
+		snprintf(yash, sizeof(yash), "%s/../yash", dirname(self));
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	for (int jobs=0; jobs<=BENCH_JOBS; jobs+=BENCH_JOBS) {
+		for (int i=0; i<sizeof(sessions)/sizeof(sessions[0]); i++) {
+			runSession(yash, &sessions[i], jobs);
+		}
+	}
+	return (EXIT_SUCCESS);
+}
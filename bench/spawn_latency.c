@@ -0,0 +1,181 @@
+/**
+ * @file  spawn_latency.c
+ *
+ * @brief Benchmark of the time from Enter to exec, with and without zygote.
+ *
+ * The benchmark runs yash with its input and output connected to pipes, and
+ * sends it a command line that runs this same program with the `--stamp`
+ * argument. The stamped program prints the monotonic clock as soon as it
+ * starts, so the difference with the time the line was sent is the time from
+ * Enter to exec.
+ *
+ * Each line of output is a set of key=value pairs, to be easy to compare
+ * between builds.
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BENCH_RUNS 300		//! Measured command lines per mode
+#define BENCH_WARMUP 20		//! Command lines run before measuring
+#define STAMP_ARG "--stamp"	//! Argument to print the clock and exit
+#define STAMP_KEY "stamp="	//! Key of the clock printed by the stamp mode
+#define BUF_LEN 4096		//! Output buffer length
+#define SYSCALL_RETURN_ERR -1	//! Value returned on a system call error
+
+
+/**
+ * @brief Get the time from a monotonic clock.
+ *
+ * @return	Time in nanoseconds
+ */
+static uint64_t nowNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000L + now.tv_nsec);
+}
+
+
+/**
+ * @brief Compare two latencies, for qsort().
+ */
+static int cmpLatency(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Run yash, and measure the time from Enter to exec of each command.
+ *
+ * @param	yash	Path to the yash executable
+ * @param	flag	Command line flag for yash, or NULL
+ * @param	self	Path to this program
+ * @param	mode	Name of the mode to print
+ */
+static void runBench(char* yash, char* flag, char* self, const char* mode) {
+	static uint64_t latency[BENCH_RUNS];
+	char line[PATH_MAX+16];
+	char buf[BUF_LEN];
+	int in_pfd[2], out_pfd[2];
+
+	if (pipe(in_pfd) == SYSCALL_RETURN_ERR || pipe(out_pfd) == SYSCALL_RETURN_ERR) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(in_pfd[0], STDIN_FILENO);
+		dup2(out_pfd[1], STDOUT_FILENO);
+		close(in_pfd[0]);
+		close(in_pfd[1]);
+		close(out_pfd[0]);
+		close(out_pfd[1]);
+		execl(yash, yash, flag, (char*)NULL);
+		perror("execl");
+		_exit(EXIT_FAILURE);
+	}
+	close(in_pfd[0]);
+	close(out_pfd[1]);
+
+	snprintf(line, sizeof(line), "%s %s\n", self, STAMP_ARG);
+	for (int i=0; i<BENCH_WARMUP+BENCH_RUNS; i++) {
+		uint64_t sent = nowNs();
+		if (write(in_pfd[1], line, strlen(line)) == SYSCALL_RETURN_ERR) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+
+		// Read the output until the stamp shows up
+		size_t len = 0;
+		char* stamp = NULL;
+		while (!stamp) {
+			ssize_t n = read(out_pfd[0], &buf[len], sizeof(buf) - len - 1);
+			if (n <= 0) {
+				fprintf(stderr, "yash exited\n");
+				exit(EXIT_FAILURE);
+			}
+			len += n;
+			buf[len] = '\0';
+			stamp = strstr(buf, STAMP_KEY);
+			if (stamp && !strchr(stamp, '\n')) {	// Partial stamp line
+				stamp = NULL;
+			}
+			if (!stamp && len > sizeof(buf) / 2) {	// Drop the echoed lines
+				len = 0;
+			}
+		}
+
+		if (i >= BENCH_WARMUP) {
+			latency[i-BENCH_WARMUP] = strtoull(stamp + strlen(STAMP_KEY), NULL, 10)
+					- sent;
+		}
+	}
+	close(in_pfd[1]);
+	close(out_pfd[0]);
+	waitpid(pid, NULL, 0);
+
+	// Print the latency distribution
+	uint64_t sum = 0;
+	for (int i=0; i<BENCH_RUNS; i++) {
+		sum += latency[i];
+	}
+	qsort(latency, BENCH_RUNS, sizeof(latency[0]), cmpLatency);
+	printf("bench=spawn_latency mode=%s runs=%d mean_us=%.1f p50_us=%.1f"
+			" p90_us=%.1f p99_us=%.1f\n", mode, BENCH_RUNS,
+			sum / 1000.0 / BENCH_RUNS, latency[BENCH_RUNS/2] / 1000.0,
+			latency[BENCH_RUNS*9/10] / 1000.0, latency[BENCH_RUNS*99/100] / 1000.0);
+	fflush(stdout);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * Usage: `spawn_latency [path/to/yash]`. By default yash is looked for in the
+ * parent folder of this program.
+ *
+ * @param argc	Number of command line arguments
+ * @param argv	Array of command line arguments
+ * @return	Errorcode
+ */
+int main(int argc, char** argv) {
+	char self[PATH_MAX];
+	char yash[PATH_MAX];
+
+	// Stamp mode
+	if (argc > 1 && !strcmp(argv[1], STAMP_ARG)) {
+		printf("%s%llu\n", STAMP_KEY, (unsigned long long)nowNs());
+		return (EXIT_SUCCESS);
+	}
+
+	if (!realpath(argv[0], self)) {
+		perror("realpath");
+		return (EXIT_FAILURE);
+	}
+	if (argc > 1) {
+		snprintf(yash, sizeof(yash), "%s", argv[1]);
+	} else {
+		char dir[PATH_MAX];
+		snprintf(dir, sizeof(dir), "%s", self);
+		snprintf(yash, sizeof(yash), "%s/../yash", dirname(dir));
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	runBench(yash, NULL, self, "fork");
+	runBench(yash, "--zygote", self, "zygote");
+	return (EXIT_SUCCESS);
+}
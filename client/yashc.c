@@ -0,0 +1,157 @@
+/**
+ * @file yashc.c
+ *
+ * @brief Client of the YASH command server.
+ *
+ * Sends a command, or every line read from stdin, to a shell started with
+ * `yash --server PATH`, and waits for each of them to finish. With `-c`, the
+ * output of the commands is captured by the server and printed. The exit status
+ * of the client is the one of the last command.
+ *
+ * Usage:
+ *
+ *     ./client/yashc [-c] PATH [COMMAND]
+ *
+ * @author:	Jose Carlos Martinez Garcia-Vaso <carlosgvaso@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_CMD_LEN 2000	//! Max command length of the shell
+#define MAX_HDR_LEN 32		//! Max reply header length
+#define EXIT_ERR 1			//! Unknown error
+#define EXIT_ERR_ARG 2		//! Wrong argument provided
+
+
+/**
+ * @brief Connect to the command server.
+ *
+ * @param	path	Path of the server socket
+ * @return	Socket descriptor, or -1 on error
+ */
+int connectServer(char* path) {
+	struct sockaddr_un addr = { 0 };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return (-1);
+	}
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+
+/**
+ * @brief Send a command and print its replies until it finishes.
+ *
+ * @param	sock		Server socket
+ * @param	replies		Server socket, opened for buffered reading
+ * @param	capture		Capture the command output boolean
+ * @param	cmd			Command line
+ * @return	Exit status of the command, or -1 on error
+ */
+int runCmd(int sock, FILE* replies, bool capture, char* cmd) {
+	char req[MAX_CMD_LEN+4];
+	char hdr[MAX_HDR_LEN];
+	char buf[BUFSIZ];
+
+	int len = snprintf(req, sizeof(req), "%c %s\n", capture ? 'C' : 'R', cmd);
+	if (len >= sizeof(req)) {
+		fprintf(stderr, "yashc: command too long\n");
+		return (EXIT_ERR_ARG);
+	}
+	if (send(sock, req, len, MSG_NOSIGNAL) != len) {
+		return (-1);
+	}
+
+	// Print the output chunks until the exit status arrives
+	while (fgets(hdr, sizeof(hdr), replies)) {
+		char type;
+		long value;
+		if (sscanf(hdr, "%c %ld", &type, &value) != 2) {
+			return (-1);
+		}
+
+		if (type == 'X') {
+			return (value);
+		}
+		while (value > 0) {
+			size_t n = fread(buf, 1, value < sizeof(buf) ? value : sizeof(buf),
+					replies);
+			if (n == 0) {
+				return (-1);
+			}
+			fwrite(buf, 1, n, stdout);
+			value -= n;
+		}
+		fflush(stdout);
+	}
+	return (-1);
+}
+
+
+/**
+ * @brief Point of entry.
+ *
+ * @param argc	Number of command line arguments
+ * @param argv	Array of command line arguments
+ * @return	Exit status of the last command
+ */
+int main(int argc, char** argv) {
+	const char USAGE[] = "Usage: yashc [-c] PATH [COMMAND]\n";
+	bool capture = false;
+	char line[MAX_CMD_LEN+2];
+	int status = 0;
+	int arg = 1;
+
+	if (arg < argc && !strcmp(argv[arg], "-c")) {
+		capture = true;
+		arg++;
+	}
+	if (arg >= argc || argc > arg + 2) {
+		fprintf(stderr, USAGE);
+		return (EXIT_ERR_ARG);
+	}
+
+	int sock = connectServer(argv[arg]);
+	if (sock == -1) {
+		fprintf(stderr, "yashc: could not connect to %s: errno %d\n",
+				argv[arg], errno);
+		return (EXIT_ERR);
+	}
+	FILE* replies = fdopen(dup(sock), "r");
+
+	if (arg + 1 < argc) {
+		status = runCmd(sock, replies, capture, argv[arg+1]);
+	} else {
+		while (status != -1 && fgets(line, sizeof(line), stdin)) {
+			line[strcspn(line, "\n")] = '\0';
+			status = runCmd(sock, replies, capture, line);
+		}
+	}
+
+	if (status == -1) {
+		fprintf(stderr, "yashc: connection to the server lost\n");
+		status = EXIT_ERR;
+	}
+	fclose(replies);
+	close(sock);
+	return (status);
+}
@@ -9,23 +9,175 @@
 #include "main.h"
 
 
+/**
+ * @brief Report the time spent on a startup stage, if profiling startup.
+ *
+ * @param	stage	Name of the stage
+ * @param	since	Start of the stage, returns the end of the stage
+ */
+void profileStage(const char* stage, uint64_t* since) {
+	uint64_t now = nowNs();
+	if (startup_profile) {
+		fprintf(stderr, "-yash: startup stage=%s usec=%.1f\n", stage,
+				(now - *since) / 1000.0);
+	}
+	*since = now;
+}
+
+
+/**
+ * @brief Batch the output of the shell.
+ *
+ * stdout is fully buffered, so the messages, job lists and traces printed
+ * while handling a line, and the next prompt, go out in a single write().
+ * Must be called before anything is printed.
+ */
+void initOutput() {
+	setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+}
+
+
+/**
+ * @brief Write the batched output of the shell.
+ *
+ * Called before waiting for events, so the output of each line shows up with
+ * the next prompt. It is called before each fork() or zygote spawn too, so
+ * children do not inherit the batched output and print it again on exit(),
+ * and by children before exec(), which would drop their own output.
+ */
+void flushOutput() {
+	fflush(stdout);
+}
+
+
 /**
  * @brief Shell initialization tasks
+ *
+ * Terminal control is only set up when stdin is a terminal, and readline and
+ * the history only when the shell is interactive too, so scripts, `-c` and
+ * the command server do not pay for them.
+ *
+ * @param	since	Start of the startup, returns the end of the last stage
  */
-void initShell() {
-	// Use shell history
-	//using_history();
+void initShell(uint64_t* since) {
+	// Set up parent process signals, to leave the terminal to the jobs
+	job_control = isatty(STDIN_FILENO);
+	if (job_control) {
+		signal(SIGTTOU, SIG_IGN);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGTSTP, SIG_IGN);
+		//signal(SIGCHLD, SIG_IGN);
+		profileStage("terminal", since);
+	}
 
-	// Set up parent process signals
-	signal(SIGTTOU, SIG_IGN);
-	signal(SIGINT, SIG_IGN);
-	signal(SIGTSTP, SIG_IGN);
-	//signal(SIGCHLD, SIG_IGN);
+	// Handle SIGCHLD and job output from the event loop
+	if (!initEvents()) {
+		printf("-yash: could not start event loop: errno %d\n", errno);
+		exit(EXIT_ERR);
+	}
+	profileStage("events", since);
+
+	// Start the zygote while the shell address space is still small
+	if (shell_opts[OPT_ZYGOTE].value) {
+		if (!startZygote()) {
+			printf("-yash: could not start zygote: errno %d\n", errno);
+			shell_opts[OPT_ZYGOTE].value = false;
+		}
+		profileStage("zygote", since);
+	}
+
+	// Use line editing and shell history
+	if (interactive) {
+		rl_initialize();
+		using_history();
+		rl_attempted_completion_function = completeCommand;
+		profileStage("readline", since);
+	}
 
 	// TODO: Other init tasks
 }
 
 
+/**
+ * @brief Read a line of input.
+ *
+ * Interactive shells read it with readline, and other shells straight from
+ * stdin, without any prompt. Stdin is never read past the end of the line, so
+ * commands of the script get the rest of it: seekable input is read in blocks
+ * and the offset moved back to the next line, and other input one byte at a
+ * time, as other shells do.
+ *
+ * @param	prompt	Prompt to show
+ * @return	Input line without the new-line, to be freed, or NULL on EOF
+ */
+char* readLine(const char* prompt) {
+	char* line = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+
+	if (interactive) {
+		return (readline(prompt));
+	}
+
+	bool seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) != SYSCALL_RETURN_ERR;
+	size_t block = seekable ? LINE_BLOCK_LEN : 1;
+	for (;;) {
+		if (len + block + 1 > cap) {
+			cap = (len + block + 1) * 2;
+			char* new_line = realloc(line, cap);
+			if (!new_line) {
+				free(line);
+				return (NULL);
+			}
+			line = new_line;
+		}
+
+		ssize_t n = read(STDIN_FILENO, &line[len], block);
+		if (n == SYSCALL_RETURN_ERR && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			break;
+		}
+
+		char* nl = memchr(&line[len], '\n', n);
+		if (nl) {
+			if (seekable) {	// Give back what was read past the line
+				lseek(STDIN_FILENO, nl + 1 - &line[len+n], SEEK_CUR);
+			}
+			*nl = '\0';
+			return (line);
+		}
+		len += n;
+	}
+
+	// Last line without a new-line
+	if (len == 0) {
+		free(line);
+		return (NULL);
+	}
+	line[len] = '\0';
+	return (line);
+}
+
+
+/**
+ * @brief Reset the signal handling of a job process.
+ *
+ * Job processes ignore SIGTTOU, but get all the other signals ignored or
+ * blocked by the shell, as blocked signals are inherited through exec().
+ */
+void resetChildSignals() {
+	sigset_t mask;
+
+	signal(SIGTTOU, SIG_IGN);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+
 /**
  * @brief Check for input that should be ignored.
  *
@@ -63,22 +215,235 @@ bool ignoreInput(char* input_str) {
  * @param	job_idx	Job index in the job_arr
  */
 void removeJob(int job_idx) {
+	// Stop the job deadline
+	clearJobDeadline(job_idx);
+
+	// Close the pidfds of the job processes
+	for (int i=0; i<job_arr[job_idx].proc_len; i++) {
+		if (job_arr[job_idx].procs[i].pidfd != NO_FD) {
+			close(job_arr[job_idx].procs[i].pidfd);
+		}
+	}
+	job_arr[job_idx].proc_len = 0;
+
 	// Clear job entries
 	job_arr[job_idx].jobno = 0;
 	job_arr[job_idx].gpid = 0;
 	strcpy(job_arr[job_idx].status, "\0");
 
+	// Release the pipe statistics
+	if (job_arr[job_idx].meter) {
+		munmap(job_arr[job_idx].meter, sizeof(struct PipeMeter));
+		job_arr[job_idx].meter = NULL;
+	}
+
+	// Release the captured output
+	if (job_arr[job_idx].ring) {
+		freeRingBuf(job_arr[job_idx].ring);
+		job_arr[job_idx].ring = NULL;
+	}
+
 	// Decrease last job number if necessary
 	if (job_idx == last_job) {
-		// Find the next job
-		bool next_job_found = false;
-		while (!next_job_found) {
+		// Find the next job, or leave the array empty
+		do {
 			last_job--;
-			if (job_arr[last_job].jobno > 0) {
-				next_job_found = true;
-			}
+		} while (last_job > EMPTY_ARRAY && job_arr[last_job].jobno <= 0);
+	}
+}
+
+
+/**
+ * @brief Find a free slot in job_arr.
+ *
+ * Slots of finished jobs are reused, so job numbers stay low while other jobs
+ * keep running.
+ *
+ * @return	Index of the free slot, or EMPTY_ARRAY if the array is full
+ */
+int findFreeJob() {
+	for (int i=0; i<MAX_CONCURRENT_JOBS; i++) {
+		if (i > last_job || job_arr[i].jobno <= 0) {
+			return (i);
+		}
+	}
+
+	// Reuse the slot of a finished job only kept for its output
+	for (int i=0; i<=last_job; i++) {
+		if (!strcmp(job_arr[i].status, JOB_STATUS_DONE)) {
+			removeJob(i);
+			return (i);
+		}
+	}
+	return (EMPTY_ARRAY);
+}
+
+
+/**
+ * @brief Create the output buffer of a background job.
+ *
+ * @param	size	Buffer size in bytes
+ * @param	spill	Spill old output to a memfd boolean
+ * @return	New buffer, or NULL on error
+ */
+struct RingBuf* newRingBuf(size_t size, bool spill) {
+	struct RingBuf* ring = malloc(sizeof(struct RingBuf) + size);
+	if (!ring) {
+		return (NULL);
+	}
+
+	ring->fd = NO_FD;
+	ring->spill = spill;
+	ring->spill_fd = NO_FD;
+	ring->spilled = 0;
+	ring->dropped = 0;
+	ring->size = size;
+	ring->start = 0;
+	ring->len = 0;
+	return (ring);
+}
+
+
+/**
+ * @brief Remove the oldest output from a job output buffer.
+ *
+ * The output is appended to the spill memfd if the buffer spills, or dropped
+ * otherwise. It is dropped as well if the memfd cannot be written.
+ *
+ * @param	ring	Output buffer
+ * @param	len		Bytes to remove
+ */
+void evictRingBuf(struct RingBuf* ring, size_t len) {
+	if (ring->spill && ring->spill_fd == NO_FD) {
+		ring->spill_fd = memfd_create("yash-job-output", MFD_CLOEXEC);
+	}
+
+	size_t done = 0;
+	while (done < len) {
+		size_t idx = (ring->start + done) % ring->size;
+		size_t seg = len - done;
+		if (seg > ring->size - idx) {	// Up to the end of the buffer
+			seg = ring->size - idx;
+		}
+
+		if (ring->spill_fd != NO_FD &&
+				write(ring->spill_fd, &ring->data[idx], seg) == seg) {
+			ring->spilled += seg;
+		} else {
+			ring->dropped += seg;
+		}
+		done += seg;
+	}
+
+	ring->start = (ring->start + len) % ring->size;
+	ring->len -= len;
+}
+
+
+/**
+ * @brief Add output to a job output buffer.
+ *
+ * The oldest output is evicted to make room for the new one, so the buffer
+ * always keeps the last output of the job. @sa evictRingBuf()
+ *
+ * @param	ring	Output buffer
+ * @param	data	New output
+ * @param	len		Length of the new output
+ */
+void writeRingBuf(struct RingBuf* ring, const char* data, size_t len) {
+	// Output larger than the buffer goes through it right away
+	if (len > ring->size) {
+		writeRingBuf(ring, data, len - ring->size);
+		data += len - ring->size;
+		len = ring->size;
+	}
+	if (ring->len + len > ring->size) {
+		evictRingBuf(ring, ring->len + len - ring->size);
+	}
+
+	size_t done = 0;
+	while (done < len) {
+		size_t idx = (ring->start + ring->len) % ring->size;
+		size_t seg = len - done;
+		if (seg > ring->size - idx) {	// Up to the end of the buffer
+			seg = ring->size - idx;
+		}
+		memcpy(&ring->data[idx], data + done, seg);
+		ring->len += seg;
+		done += seg;
+	}
+}
+
+
+/**
+ * @brief Event handler to drain the output pipe of a background job.
+ *
+ * @param	fd		Output pipe read end
+ * @param	events	Ready events
+ * @param	data	Output buffer of the job
+ */
+void drainRingBuf(int fd, uint32_t events, void* data) {
+	static char chunk[RING_CHUNK];
+	struct RingBuf* ring = data;
+
+	ssize_t n = read(fd, chunk, RING_CHUNK);
+	if (n > 0) {
+		writeRingBuf(ring, chunk, n);
+	} else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+		// Every process writing to the pipe exited
+		removeEventSource(fd);
+		close(fd);
+		ring->fd = NO_FD;
+	}
+}
+
+
+/**
+ * @brief Print the output kept in a job output buffer.
+ *
+ * The spilled output is printed first, as it is older.
+ *
+ * @param	ring	Output buffer
+ */
+void printRingBuf(struct RingBuf* ring) {
+	char chunk[BUFSIZ];
+
+	flushOutput();
+	for (off_t off=0; off<ring->spilled; ) {
+		ssize_t n = pread(ring->spill_fd, chunk, sizeof(chunk), off);
+		if (n <= 0 || write(STDOUT_FILENO, chunk, n) != n) {
+			break;
 		}
+		off += n;
+	}
+
+	size_t first = ring->len;
+	if (first > ring->size - ring->start) {	// Up to the end of the buffer
+		first = ring->size - ring->start;
+	}
+	fwrite(&ring->data[ring->start], 1, first, stdout);
+	fwrite(ring->data, 1, ring->len - first, stdout);
+
+	if (ring->dropped) {
+		printf("\n-yash: %" PRIu64 " bytes of older output dropped\n", ring->dropped);
+	}
+}
+
+
+/**
+ * @brief Release a job output buffer.
+ *
+ * @param	ring	Output buffer
+ */
+void freeRingBuf(struct RingBuf* ring) {
+	if (ring->fd != NO_FD) {
+		removeEventSource(ring->fd);
+		close(ring->fd);
+	}
+	if (ring->spill_fd != NO_FD) {
+		close(ring->spill_fd);
 	}
+	free(ring);
 }
 
 
@@ -98,8 +463,16 @@ void printJob(int job_idx) {
 		printf("-");
 	}
 
-	// Print job status
-	printf(" %s", job_arr[job_idx].status);
+	// Print job status, with the exit status of failed jobs
+	if (!strcmp(job_arr[job_idx].status, JOB_STATUS_DONE) &&
+			job_arr[job_idx].exit_status != EXIT_OK) {
+		printf(" Exit %d", job_arr[job_idx].exit_status);
+	} else {
+		printf(" %s", job_arr[job_idx].status);
+	}
+	if (job_arr[job_idx].timed_out) {
+		printf(" (timeout)");
+	}
 
 	// Print job command string
 	printf("\t");
@@ -110,6 +483,161 @@ void printJob(int job_idx) {
 }
 
 
+/**
+ * @brief Format a CPU set as a list of CPU ranges, like "0-3,8".
+ *
+ * @param	cpus	CPU set
+ * @param	str		String to save the list to
+ * @param	len		Size of the string
+ */
+void formatCpuSet(cpu_set_t* cpus, char* str, size_t len) {
+	size_t pos = 0;
+	str[0] = '\0';
+
+	for (int cpu=0; cpu<CPU_SETSIZE && pos<len; cpu++) {
+		if (!CPU_ISSET(cpu, cpus)) {
+			continue;
+		}
+
+		// Find the end of the range
+		int last = cpu;
+		while (last+1 < CPU_SETSIZE && CPU_ISSET(last+1, cpus)) {
+			last++;
+		}
+
+		if (last == cpu) {
+			pos += snprintf(&str[pos], len-pos, "%s%d", pos ? "," : "", cpu);
+		} else {
+			pos += snprintf(&str[pos], len-pos, "%s%d-%d", pos ? "," : "", cpu,
+					last);
+		}
+		cpu = last;
+	}
+}
+
+
+/**
+ * @brief Print the placement of every running process of a job.
+ *
+ * The CPU affinity, nice value and I/O priority are read from the processes, so
+ * they show what is in effect, and not only what was set by job prefixes.
+ *
+ * @param	job_idx	Job array index
+ */
+void printJobPlacement(int job_idx) {
+	const char* IOPRIO_CLASS_NAMES[] = { "none", "rt", "be", "idle" };
+	char cpus_str[MAX_CMD_LEN+1];
+	cpu_set_t cpus;
+
+	for (int i=0; i<CHILD_COUNT_PIPE; i++) {
+		pid_t pid = job_arr[job_idx].pids[i];
+		if (pid <= 0) {	// Stage not run, or already reaped
+			continue;
+		}
+
+		printf("\t%d", pid);
+
+		if (sched_getaffinity(pid, sizeof(cpus), &cpus) != SYSCALL_RETURN_ERR) {
+			formatCpuSet(&cpus, cpus_str, sizeof(cpus_str));
+			printf(" cpus %s", cpus_str);
+		}
+
+		errno = 0;
+		int prio = getpriority(PRIO_PROCESS, pid);
+		if (errno == 0) {
+			printf(" nice %d", prio);
+		}
+
+		int ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+		if (ioprio != SYSCALL_RETURN_ERR) {
+			printf(" io %s/%ld", IOPRIO_CLASS_NAMES[IOPRIO_PRIO_CLASS(ioprio) % 4],
+					IOPRIO_PRIO_DATA(ioprio));
+		}
+		printf("\n");
+	}
+}
+
+
+/**
+ * @brief Get the time from a monotonic clock.
+ *
+ * @return	Time in nanoseconds
+ */
+uint64_t nowNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec);
+}
+
+
+/**
+ * @brief Print the statistics of a metered pipe.
+ *
+ * The throughput and bottleneck are computed since the last time the statistics
+ * were printed, so calling this repeatedly shows live values.
+ *
+ * @param	cmd	Command with the metered pipe
+ */
+void printPipeMeter(struct Job* cmd) {
+	struct PipeMeter now = *cmd->meter;
+	struct PipeMeter* last = &cmd->meter_last;
+	const char* bound = "balanced";
+
+	// Time window since the statistics were last printed
+	uint64_t end_ns = now.end_ns ? now.end_ns : nowNs();
+	uint64_t since_ns = last->end_ns ? last->end_ns : now.start_ns;
+	uint64_t window_ns = end_ns > since_ns ? end_ns - since_ns : 1;
+	uint64_t wait_in_ns = now.wait_in_ns - last->wait_in_ns;
+	uint64_t wait_out_ns = now.wait_out_ns - last->wait_out_ns;
+
+	// The stage the helper waits for the most is the fastest one
+	if (wait_in_ns > wait_out_ns && wait_in_ns > window_ns/4) {
+		bound = "producer-bound";
+	} else if (wait_out_ns > wait_in_ns && wait_out_ns > window_ns/4) {
+		bound = "consumer-bound";
+	}
+
+	printf("\tpipe 1->2: %.1f MB, %.1f MB/s, waiting on producer %d%%,"
+			" on consumer %d%%, %s\n", now.bytes / BYTES_PER_MB,
+			(now.bytes - last->bytes) / BYTES_PER_MB / window_ns * NSEC_PER_SEC,
+			(int)(100 * wait_in_ns / window_ns),
+			(int)(100 * wait_out_ns / window_ns), bound);
+
+	// Start the next window
+	*last = now;
+	last->end_ns = end_ns;
+}
+
+
+/**
+ * @brief Find a job from a job spec.
+ *
+ * Job specs are `%N` for job number N, and `%+` or `%%` for the current job.
+ *
+ * @param	spec	Job spec
+ * @return	Job array index, or EMPTY_ARRAY if there is no such active job
+ */
+int findJob(char* spec) {
+	const char JOB_SPEC_CURRENT_1[3] = "%+\0";
+	const char JOB_SPEC_CURRENT_2[3] = "%%\0";
+	long jobno;
+
+	if (!strcmp(JOB_SPEC_CURRENT_1, spec) || !strcmp(JOB_SPEC_CURRENT_2, spec)) {
+		return last_job;
+	}
+	if (spec[0] != '%' || !parseNumber(&spec[1], 1, MAX_CONCURRENT_JOBS, &jobno)) {
+		return EMPTY_ARRAY;
+	}
+
+	for (int i=0; i<=last_job; i++) {
+		if (job_arr[i].jobno == jobno) {
+			return i;
+		}
+	}
+	return EMPTY_ARRAY;
+}
+
+
 /**
  * @brief Send command to the background.
  *
@@ -133,10 +661,44 @@ void fgExec() {
 /**
  * @brief Display jobs table.
  *
- * TODO: Implement jobs
+ * Usage: `jobs [-l] [-m] [-o] [%N]`
+ *
+ * Options:
+ * - `-l`: also show the PID and placement of every process of the job.
+ * - `-m`: also show the throughput and bottleneck of metered pipes.
+ * - `-o`: also show the captured output of the job. Finished jobs are removed
+ *   once their output is shown. @sa RingBuf
+ * - `%N`: only show job N.
+ *
+ * @param	argc	Number of arguments
+ * @param	argv	Arguments, starting with the command name
  */
-void jobsExec() {
-	// Update the jobs table
+void jobsExec(int argc, char** argv) {
+	const char JOBS_L_OPT[3] = "-l\0";
+	const char JOBS_M_OPT[3] = "-m\0";
+	const char JOBS_O_OPT[3] = "-o\0";
+	bool long_fmt = false;
+	bool meter_fmt = false;
+	bool output_fmt = false;
+	char* spec = NULL;
+
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(JOBS_L_OPT, argv[i])) {
+			long_fmt = true;
+		} else if (!strcmp(JOBS_M_OPT, argv[i])) {
+			meter_fmt = true;
+		} else if (!strcmp(JOBS_O_OPT, argv[i])) {
+			output_fmt = true;
+		} else if (argv[i][0] == '%') {
+			spec = argv[i];
+		} else {
+			printf("-yash: jobs: unknown option: %s\n", argv[i]);
+			return;
+		}
+	}
+
+	// Update the jobs table and the captured output
+	runEvents(0);
 	maintainJobsTable();
 
 	// Check we at least have one job in the list
@@ -145,45 +707,284 @@ void jobsExec() {
 		return;
 	}
 
+	// Find the only job to print
+	int only_job = EMPTY_ARRAY;
+	if (spec) {
+		only_job = findJob(spec);
+		if (only_job == EMPTY_ARRAY) {
+			printf("-yash: jobs: %s: no such job\n", spec);
+			return;
+		}
+	}
+
 	// Iterate over all the jobs in the array
 	for (int i=0; i<=last_job; i++) {
-		// Only print active jobs
-		if (!strcmp(job_arr[i].status, JOB_STATUS_RUNNING) ||
-				!strcmp(job_arr[i].status, JOB_STATUS_STOPPED)) {
+		// Only print jobs in use
+		if (job_arr[i].jobno > 0 &&
+				(only_job == EMPTY_ARRAY || only_job == i)) {
 			// Print the job info
 			printJob(i);
+			if (long_fmt) {
+				printJobPlacement(i);
+			}
+			if (meter_fmt && job_arr[i].meter) {
+				printPipeMeter(&job_arr[i]);
+			}
+			if (output_fmt && job_arr[i].ring) {
+				printRingBuf(job_arr[i].ring);
+				if (!strcmp(job_arr[i].status, JOB_STATUS_DONE)) {
+					removeJob(i);
+				}
+			}
 		}
 	}
 }
 
 
 /**
- * @brief Check if input is shell command, and run it.
+ * @brief Set or display shell options.
  *
- * @param	input	Raw input string
- * @return	True if shell command ran, false if it is not a shell command
+ * Usage:
+ * - `set`: display all options and their values, and the plan cache hit and
+ *   miss counters.
+ * - `set -o option`: enable an option.
+ * - `set +o option`: disable an option.
+ * - `set -o option=value`: set an option to a numeric value.
+ *
+ * @param	argc	Number of arguments
+ * @param	argv	Arguments, starting with the command name
+ *
+ * @sa ShellOpt
  */
-bool runShellCmd(char* input) {
-	if (!strcmp(input, CMD_BG)) {
-		bgExec();
-		return true;
-	} else if (!strcmp(input, CMD_FG)) {
-		fgExec();
-		return true;
-	} else if (!strcmp(input, CMD_JOBS)) {
-		jobsExec();
-		return true;
+void setExec(int argc, char** argv) {
+	const char SET_ON_OPT[3] = "-o\0";
+	const char SET_OFF_OPT[3] = "+o\0";
+	const char SET_ERR_1[MAX_ERROR_LEN] = "set: usage: set [-o|+o] option[=value]\0";
+	const char SET_ERR_2[MAX_ERROR_LEN] = "set: unknown option: \0";
+	const char SET_ERR_3[MAX_ERROR_LEN] = "set: invalid value: \0";
+
+	// Display all options, and the plan cache counters
+	if (argc == 1) {
+		for (int i=0; i<OPT_NUM; i++) {
+			printf("%s\t%d\n", shell_opts[i].name, shell_opts[i].value);
+		}
+		printf("plancache_hits\t%" PRIu64 "\n", plan_hits);
+		printf("plancache_misses\t%" PRIu64 "\n", plan_misses);
+		return;
 	}
-	return false;
+
+	if (argc != 3 || (strcmp(SET_ON_OPT, argv[1]) && strcmp(SET_OFF_OPT, argv[1]))) {
+		printf("-yash: %s\n", SET_ERR_1);
+		return;
+	}
+
+	// Get the option value
+	long value = !strcmp(SET_ON_OPT, argv[1]);
+	char* value_str = strchr(argv[2], '=');
+	if (value_str) {
+		*value_str = '\0';
+		value_str++;
+		if (!parseNumber(value_str, INT32_MIN, INT32_MAX, &value)) {
+			printf("-yash: %s%s\n", SET_ERR_3, value_str);
+			return;
+		}
+	}
+
+	// Set the option
+	for (int i=0; i<OPT_NUM; i++) {
+		if (!strcmp(shell_opts[i].name, argv[2])) {
+			shell_opts[i].value = value;
+			return;
+		}
+	}
+	printf("-yash: %s%s\n", SET_ERR_2, argv[2]);
 }
 
 
 /**
- * @brief Split a command string into string tokens.
+ * @brief Wait for background jobs to finish.
  *
- * This function assumes the `cmd.cmd_str` is not an empty string.
+ * Usage:
+ * - `wait`: wait for all running jobs.
+ * - `wait %N`: wait for job N.
+ * - `wait PID`: wait for the job process with the given PID.
+ * - `wait -n`: wait for the next job to finish.
  *
- * This function uses strtok() to split a command string into string tokens.
+ * The shell sleeps in the event loop, which wakes up on SIGCHLD, and on
+ * SIGINT to stop waiting. The exit status of the job or process waited for is
+ * saved to `last_status`.
+ *
+ * @param	argc	Number of arguments
+ * @param	argv	Arguments, starting with the command name
+ */
+void waitExec(int argc, char** argv) {
+	const char WAIT_N_OPT[3] = "-n\0";
+	const char WAIT_ERR_1[MAX_ERROR_LEN] = "wait: usage: wait [-n | %N | PID]\0";
+	const char WAIT_ERR_2[MAX_ERROR_LEN] = "wait: not available in server mode\0";
+	const char WAIT_ERR_3[MAX_ERROR_LEN] = "wait: no such job: \0";
+	int job_idx = EMPTY_ARRAY;
+	int proc_idx = EMPTY_ARRAY;
+	bool any = false;
+	bool reaped = false;	// A job finished, for `wait -n`
+	long pid;
+
+	// A client waiting would block the whole server
+	if (server_running) {
+		printf("-yash: %s\n", WAIT_ERR_2);
+		last_status = EXIT_ERR_ARG;
+		return;
+	}
+
+	// Find the job or process to wait for
+	if (argc > 2) {
+		printf("-yash: %s\n", WAIT_ERR_1);
+		last_status = EXIT_ERR_ARG;
+		return;
+	} else if (argc == 2 && !strcmp(WAIT_N_OPT, argv[1])) {
+		any = true;
+	} else if (argc == 2 && argv[1][0] == '%') {
+		job_idx = findJob(argv[1]);
+	} else if (argc == 2) {
+		if (!parseNumber(argv[1], 1, INT32_MAX, &pid)) {
+			printf("-yash: %s\n", WAIT_ERR_1);
+			last_status = EXIT_ERR_ARG;
+			return;
+		}
+		for (int i=0; i<=last_job && proc_idx == EMPTY_ARRAY; i++) {
+			for (int j=0; j<job_arr[i].proc_len; j++) {
+				if (job_arr[i].jobno > 0 && job_arr[i].procs[j].pid == pid) {
+					job_idx = i;
+					proc_idx = j;
+				}
+			}
+		}
+	}
+	if (argc == 2 && !any && job_idx == EMPTY_ARRAY) {
+		printf("-yash: %s%s\n", WAIT_ERR_3, argv[1]);
+		last_status = EXIT_NO_JOB;
+		return;
+	}
+
+	// Get SIGINT from the event loop while waiting
+	sigset_t int_mask;
+	sigset_t fd_mask;
+	sigemptyset(&int_mask);
+	sigaddset(&int_mask, SIGINT);
+	sigemptyset(&fd_mask);
+	sigaddset(&fd_mask, SIGCHLD);
+	sigaddset(&fd_mask, SIGINT);
+	sigprocmask(SIG_BLOCK, &int_mask, NULL);
+	signalfd(signal_fd, &fd_mask, 0);
+	interrupted = false;
+
+	last_status = any ? EXIT_NO_JOB : EXIT_OK;
+	while (!interrupted) {
+		bool waiting = false;
+
+		if (proc_idx != EMPTY_ARRAY) {	// Wait for a process
+			reapJob(job_idx);
+			if (job_arr[job_idx].procs[proc_idx].reaped) {
+				last_status = job_arr[job_idx].procs[proc_idx].status;
+			} else {
+				waiting = true;
+			}
+		} else if (job_idx != EMPTY_ARRAY) {	// Wait for a job
+			if (!strcmp(job_arr[job_idx].status, JOB_STATUS_DONE) ||
+					reapJob(job_idx)) {
+				last_status = job_arr[job_idx].exit_status;
+			} else {
+				waiting = true;
+			}
+		} else {	// Wait for the next job, or for all of them
+			for (int i=0; i<=last_job; i++) {
+				if (strcmp(job_arr[i].status, JOB_STATUS_RUNNING)) {
+					continue;
+				}
+				if (reapJob(i)) {
+					reaped = true;
+					last_status = any ? job_arr[i].exit_status : EXIT_OK;
+					if (any) {
+						break;
+					}
+				} else {
+					waiting = true;
+				}
+			}
+			if (any && reaped) {
+				waiting = false;
+			}
+		}
+
+		if (!waiting) {
+			break;
+		}
+		runEvents(-1);
+	}
+
+	if (interrupted) {
+		printf("\n");	// Ensure there is an space after "^C"
+		last_status = EXIT_SIGNAL + SIGINT;
+	}
+	sigdelset(&fd_mask, SIGINT);
+	signalfd(signal_fd, &fd_mask, 0);
+	sigprocmask(SIG_UNBLOCK, &int_mask, NULL);
+
+	// Show the finished jobs
+	maintainJobsTable();
+}
+
+
+/**
+ * @brief Check if input is shell command, and run it.
+ *
+ * @param	input	Raw input string
+ * @return	True if shell command ran, false if it is not a shell command
+ */
+bool runShellCmd(char* input) {
+	const char CMD_TOKEN_DELIM[2] = " \0";
+	char cmd_str[MAX_CMD_LEN+1];
+	char* argv[MAX_TOKEN_NUM];
+	int argc = 0;
+
+	// Tokenize a copy of the input, so it can still be parsed as a job
+	strncpy(cmd_str, input, MAX_CMD_LEN);
+	cmd_str[MAX_CMD_LEN] = '\0';
+	argv[argc] = strtok(cmd_str, CMD_TOKEN_DELIM);
+	while (argv[argc] && argc < MAX_TOKEN_NUM-1) {
+		argc++;
+		argv[argc] = strtok(NULL, CMD_TOKEN_DELIM);
+	}
+	if (argc == 0) {
+		return false;
+	}
+
+	last_status = EXIT_OK;
+	if (!strcmp(argv[0], CMD_BG)) {
+		bgExec();
+		return true;
+	} else if (!strcmp(argv[0], CMD_FG)) {
+		fgExec();
+		return true;
+	} else if (!strcmp(argv[0], CMD_JOBS)) {
+		jobsExec(argc, argv);
+		return true;
+	} else if (!strcmp(argv[0], CMD_SET)) {
+		setExec(argc, argv);
+		return true;
+	} else if (!strcmp(argv[0], CMD_WAIT)) {
+		waitExec(argc, argv);
+		return true;
+	}
+	return false;
+}
+
+
+/**
+ * @brief Split a command string into string tokens.
+ *
+ * This function assumes the `cmd.cmd_str` is not an empty string.
+ *
+ * This function uses strtok() to split a command string into string tokens.
  * Tokens are considered to be contiguous characters separated by whitespace.
  *
  * @param	cmd	Command struct
@@ -191,7 +992,7 @@ bool runShellCmd(char* input) {
  * @sa strtok(), Cmd
  */
 void tokenizeString(struct Job* cmd) {
-	const char CMD_TOKEN_DELIM = ' ';	// From requirements
+	const char CMD_TOKEN_DELIM[2] = " \0";	// From requirements
 	size_t len = 0;
 
 	// Remove final newline char and replace with NULL char
@@ -201,16 +1002,670 @@ void tokenizeString(struct Job* cmd) {
 	}
 
 	// Break down the command into tokens using strtok
-	cmd->cmd_tok[0] = strtok(cmd->cmd_str, &CMD_TOKEN_DELIM);
+	cmd->cmd_tok[0] = strtok(cmd->cmd_str, CMD_TOKEN_DELIM);
 	uint32_t count = 1;	// Start at one because we already run strtok once
 
-	while ((cmd->cmd_tok[count] = strtok(NULL, &CMD_TOKEN_DELIM))) {
+	while ((cmd->cmd_tok[count] = strtok(NULL, CMD_TOKEN_DELIM))) {
 		count++;
 	}
 	cmd->cmd_tok_len = count;
 }
 
 
+/**
+ * @brief Parse a decimal number within a range.
+ *
+ * @param	str		String to parse
+ * @param	min		Min value allowed
+ * @param	max		Max value allowed
+ * @param	value	Returns the number
+ * @return	True if the whole string is a number in the range, false otherwise
+ */
+bool parseNumber(char* str, long min, long max, long* value) {
+	char* end;
+
+	if (!str || !strcmp(str, EMPTY_STR)) {
+		return false;
+	}
+
+	errno = 0;
+	*value = strtol(str, &end, 10);
+	return (!errno && *end == '\0' && *value >= min && *value <= max);
+}
+
+
+/**
+ * @brief Parse a list of CPUs, like "0-3,8", to a CPU set.
+ *
+ * @param	list	CPU list
+ * @param	cpus	Returns the CPU set
+ * @return	True on success, false if the list is not valid or empty
+ */
+bool parseCpuList(char* list, cpu_set_t* cpus) {
+	char* pos = list;
+	char* end;
+
+	CPU_ZERO(cpus);
+	while (*pos) {
+		long first = strtol(pos, &end, 10);
+		long last = first;
+		if (end == pos || first < 0) {
+			return false;
+		}
+
+		// CPU range
+		if (*end == '-') {
+			pos = end + 1;
+			last = strtol(pos, &end, 10);
+			if (end == pos || last < first) {
+				return false;
+			}
+		}
+		if (last >= CPU_SETSIZE) {
+			return false;
+		}
+
+		for (long cpu=first; cpu<=last; cpu++) {
+			CPU_SET(cpu, cpus);
+		}
+
+		// Next item of the list
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return false;
+		}
+		pos = end;
+	}
+
+	return (CPU_COUNT(cpus) > 0);
+}
+
+
+/**
+ * @brief Parse a duration, as taken by timeout(1).
+ *
+ * A duration is a number of seconds, which may be fractional, followed by an
+ * optional unit: `s` for seconds, `m` for minutes, `h` for hours or `d` for
+ * days.
+ *
+ * @param	str	String to parse
+ * @param	ns	Parsed duration in nanoseconds
+ * @return	True on success, false if the string is not a valid duration
+ */
+bool parseDuration(char* str, uint64_t* ns) {
+	char* end;
+	double unit = 1;
+
+	errno = 0;
+	double value = strtod(str, &end);
+	if (end == str || errno || !(value >= 0)) {
+		return false;
+	}
+
+	switch (*end) {
+		case '\0':
+		case 's':
+			break;
+		case 'm':
+			unit = 60;
+			break;
+		case 'h':
+			unit = 60*60;
+			break;
+		case 'd':
+			unit = 24*60*60;
+			break;
+		default:
+			return false;
+	}
+	if (*end != '\0' && end[1] != '\0') {
+		return false;
+	}
+
+	value *= unit;
+	if (value > MAX_DURATION_SEC) {
+		return false;
+	}
+	*ns = value * NSEC_PER_SEC;
+	return true;
+}
+
+
+/**
+ * @brief Parse the scheduling prefixes of a job.
+ *
+ * Prefixes come before the first command of the job, and apply to every process
+ * of the job. Supported prefixes are:
+ *
+ * - `nice [-n N | -N]`: add N (DEFAULT_NICE by default) to the nice value.
+ * - `taskset -c LIST`: set the CPU affinity to a list of CPUs, like "0-3,8".
+ * - `taskset MASK`: set the CPU affinity to a hexadecimal CPU mask.
+ * - `taskset -s`: pin each stage to a different CPU.
+ * - `ionice -c CLASS [-n LEVEL]`: set the I/O scheduling class (1: realtime,
+ *   2: best-effort, 3: idle) and priority level (0 to 7).
+ * - `pipesize SIZE`: set the pipe buffer size in bytes.
+ * - `pipesize auto`: grow the pipe buffer when the left stage blocks on it.
+ * - `timeout [-k KILL] DURATION`: send SIGTERM to the job after DURATION, and
+ *   SIGKILL after KILL more (DEFAULT_KILL_AFTER_NSEC by default).
+ *
+ * A prefix whose arguments do not match, or with no command after it, is not
+ * taken. It is run as a command instead, so the tools of the same name, like
+ * `taskset -p PID` or `timeout --signal=KILL 5 cmd`, still work.
+ *
+ * On return, `tok_idx` points to the first token after the prefixes.
+ *
+ * @param	cmd		Command struct
+ * @param	tok_idx	Index of the first token to check
+ *
+ * @sa SchedAttr
+ */
+void parseSchedPrefix(struct Job* cmd, uint32_t* tok_idx) {
+	const char NICE_N_OPT[3] = "-n\0";
+	const char TASKSET_C_OPT[3] = "-c\0";
+	const char TASKSET_S_OPT[3] = "-s\0";
+	const char IONICE_C_OPT[3] = "-c\0";
+	const char IONICE_N_OPT[3] = "-n\0";
+	const char TIMEOUT_K_OPT[3] = "-k\0";
+	uint32_t i = *tok_idx;
+	uint32_t len = cmd->cmd_tok_len;
+	char** tok = cmd->cmd_tok;
+	long value;
+
+	while (i < len) {
+		char* prefix = tok[i];
+		bool ok = true;
+
+		// Keep the settings to undo a prefix that is not taken
+		struct SchedAttr sched = cmd->sched;
+		int pipe_size = cmd->pipe_size;
+		bool pipe_auto = cmd->pipe_auto;
+		uint64_t timeout_ns = cmd->timeout_ns;
+		uint64_t kill_after_ns = cmd->kill_after_ns;
+		uint32_t prefix_idx = i;
+
+		if (!strcmp(PREFIX_NICE, prefix)) {
+			cmd->sched.nice = DEFAULT_NICE;
+			cmd->sched.nice_set = true;
+			if (i+2 < len && !strcmp(NICE_N_OPT, tok[i+1])) {
+				ok = parseNumber(tok[i+2], -2*PRIO_MAX, 2*PRIO_MAX, &value);
+				cmd->sched.nice = value;
+				i += 2;
+			} else if (i+1 < len && tok[i+1][0] == '-' &&
+					parseNumber(&tok[i+1][1], 0, 2*PRIO_MAX, &value)) {
+				cmd->sched.nice = value;
+				i++;
+			}
+		} else if (!strcmp(PREFIX_TASKSET, prefix)) {
+			if (i+2 < len && !strcmp(TASKSET_C_OPT, tok[i+1])) {
+				ok = parseCpuList(tok[i+2], &cmd->sched.cpus);
+				cmd->sched.cpus_set = true;
+				i += 2;
+			} else if (i+1 < len && !strcmp(TASKSET_S_OPT, tok[i+1])) {
+				cmd->sched.spread = true;
+				i++;
+			} else if (i+1 < len) {	// Hexadecimal mask
+				char* end;
+				errno = 0;
+				unsigned long long mask = strtoull(tok[i+1], &end, 16);
+				ok = (!errno && *end == '\0' && mask > 0);
+				CPU_ZERO(&cmd->sched.cpus);
+				for (int cpu=0; cpu<64; cpu++) {
+					if (mask & (1ULL << cpu)) {
+						CPU_SET(cpu, &cmd->sched.cpus);
+					}
+				}
+				cmd->sched.cpus_set = true;
+				i++;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(PREFIX_IONICE, prefix)) {
+			long ioclass = IOPRIO_CLASS_BE;
+			long level = IOPRIO_NORM;
+			bool class_set = false;
+			bool level_set = false;
+			while (ok && i+2 < len && (!strcmp(IONICE_C_OPT, tok[i+1]) ||
+					!strcmp(IONICE_N_OPT, tok[i+1]))) {
+				if (!strcmp(IONICE_C_OPT, tok[i+1])) {
+					ok = parseNumber(tok[i+2], IOPRIO_CLASS_RT, IOPRIO_CLASS_IDLE,
+							&ioclass);
+					class_set = true;
+				} else {
+					ok = parseNumber(tok[i+2], 0, IOPRIO_NR_LEVELS-1, &level);
+					level_set = true;
+				}
+				i += 2;
+			}
+			ok = ok && (class_set || level_set);
+			if (ioclass == IOPRIO_CLASS_IDLE) {
+				level = 0;	// The idle class has no levels
+			}
+			cmd->sched.ioprio = IOPRIO_PRIO_VALUE(ioclass, level);
+			cmd->sched.ioprio_set = true;
+		} else if (!strcmp(PREFIX_PIPESIZE, prefix)) {
+			if (i+1 < len && !strcmp(PIPESIZE_AUTO, tok[i+1])) {
+				cmd->pipe_auto = true;
+			} else {
+				ok = (i+1 < len && parseNumber(tok[i+1], 1, INT32_MAX, &value));
+				cmd->pipe_size = value;
+			}
+			i++;
+		} else if (!strcmp(PREFIX_TIMEOUT, prefix)) {
+			if (i+2 < len && !strcmp(TIMEOUT_K_OPT, tok[i+1])) {
+				ok = parseDuration(tok[i+2], &cmd->kill_after_ns);
+				i += 2;
+			}
+			ok = ok && i+1 < len && parseDuration(tok[i+1], &cmd->timeout_ns) &&
+					cmd->timeout_ns > 0;
+			i++;
+		} else {	// Not a prefix
+			break;
+		}
+
+		i++;
+
+		// Run the prefix as a command if it does not match, or has no command
+		if (!ok || i >= len) {
+			cmd->sched = sched;
+			cmd->pipe_size = pipe_size;
+			cmd->pipe_auto = pipe_auto;
+			cmd->timeout_ns = timeout_ns;
+			cmd->kill_after_ns = kill_after_ns;
+			i = prefix_idx;
+			break;
+		}
+	}
+
+	*tok_idx = i;
+}
+
+
+/**
+ * @brief Parse a process substitution.
+ *
+ * This function assumes the token at `tok_idx` starts with `<(` or `>(`. The
+ * tokens up to the one ending with `)` are copied to `cmd.psub_str`, and
+ * saved as a new command in `cmd.psub_argv`. On return, `tok_idx` points to
+ * the last token of the substitution.
+ *
+ * Nested substitutions, pipes and redirections inside the substitution are not
+ * supported. Those tokens are passed as arguments to the substituted command.
+ *
+ * A substitution that is the target of a redirection must go the same way as
+ * it: `<(cmd)` for input, and `>(cmd)` for output and error.
+ *
+ * @param	cmd		Command struct
+ * @param	tok_idx	Index of the first token of the substitution
+ * @param	stage	Stage of the job using the substitution (1 or 2)
+ * @param	redir	Redirection it is the target of, or PSUB_ARG
+ * @return	True on success, false on syntax error (`cmd.err_msg` is set)
+ *
+ * @sa ProcSub
+ */
+bool parseProcSub(struct Job* cmd, uint32_t* tok_idx, uint8_t stage,
+		uint8_t redir) {
+	const char SYNTAX_ERR_1[MAX_ERROR_LEN] = "syntax error: too many process"
+			" substitutions\0";
+	const char SYNTAX_ERR_2[MAX_ERROR_LEN] = "syntax error: unterminated process"
+			" substitution near token \0";
+	const char SYNTAX_ERR_3[MAX_ERROR_LEN] = "syntax error: empty process"
+			" substitution\0";
+	const char SYNTAX_ERR_4[MAX_ERROR_LEN] = "syntax error: process substitution"
+			" does not match the redirection near token \0";
+	const char PSUB_END = ')';
+
+	if (cmd->psub_len >= MAX_PROC_SUBS) {
+		strcpy(cmd->err_msg, SYNTAX_ERR_1);
+		return false;
+	}
+
+	bool out = (cmd->cmd_tok[*tok_idx][0] == '>');
+	if ((redir == PSUB_REDIR_IN && out) || ((redir == PSUB_REDIR_OUT ||
+			redir == PSUB_REDIR_ERR) && !out)) {
+		strcpy(cmd->err_msg, SYNTAX_ERR_4);
+		strcat(cmd->err_msg, cmd->cmd_tok[*tok_idx]);
+		return false;
+	}
+
+	// Place the new command after the previous one in psub_argv and psub_str
+	uint32_t argv_idx = 0;
+	size_t str_idx = 0;
+	if (cmd->psub_len > 0) {
+		argv_idx = cmd->psub[cmd->psub_len-1].argv_idx;
+		while (cmd->psub_argv[argv_idx+1]) {
+			argv_idx++;
+		}
+		str_idx = cmd->psub_argv[argv_idx] - cmd->psub_str
+				+ strlen(cmd->psub_argv[argv_idx]) + 1;
+		argv_idx += 2;	// Skip the last argument and the NULL terminator
+	}
+
+	struct ProcSub* psub = &cmd->psub[cmd->psub_len];
+	psub->argv_idx = argv_idx;
+	psub->out = out;
+	psub->stage = stage;
+	psub->redir = redir;
+	psub->fd = NO_FD;
+	psub->pid = 0;
+
+	// Copy tokens until the closing parenthesis, skipping the opening "<("
+	char* tok = cmd->cmd_tok[*tok_idx] + 2;
+	uint32_t argc = 0;
+	bool closed = false;
+	while (!closed) {
+		size_t len = strlen(tok);
+		if (len > 0 && tok[len-1] == PSUB_END) {
+			closed = true;
+			len--;
+		}
+
+		if (len > 0) {
+			memcpy(&cmd->psub_str[str_idx], tok, len);
+			cmd->psub_str[str_idx+len] = '\0';
+			cmd->psub_argv[argv_idx+argc] = &cmd->psub_str[str_idx];
+			str_idx += len + 1;
+			argc++;
+		}
+
+		if (!closed) {
+			if (*tok_idx >= cmd->cmd_tok_len-1) {	// No closing token left
+				strcpy(cmd->err_msg, SYNTAX_ERR_2);
+				strcat(cmd->err_msg, cmd->cmd_tok[*tok_idx]);
+				return false;
+			}
+			(*tok_idx)++;
+			tok = cmd->cmd_tok[*tok_idx];
+		}
+	}
+
+	if (argc == 0) {
+		strcpy(cmd->err_msg, SYNTAX_ERR_3);
+		return false;
+	}
+	cmd->psub_argv[argv_idx+argc] = NULL;
+	cmd->psub_len++;
+
+	return true;
+}
+
+
+/**
+ * @brief Parse the bounds and step of a brace sequence.
+ *
+ * @param	group	Brace group, with its braces set
+ * @return	True if the group is a sequence, false otherwise
+ */
+bool parseBraceSeq(struct BraceGroup* group) {
+	char bound[3][MAX_SEQ_LEN+1];
+	long value[3] = { 0, 0, 1 };
+	int len = 0;
+
+	// Split the sequence at each ".."
+	char* c = group->start + 1;
+	for (;;) {
+		char* stop = strstr(c, "..");
+		if (!stop || stop > group->end) {
+			stop = group->end;
+		}
+		if (len == 3 || stop == c || stop - c > MAX_SEQ_LEN) {
+			return (false);
+		}
+		memcpy(bound[len], c, stop - c);
+		bound[len++][stop-c] = '\0';
+		if (stop == group->end) {
+			break;
+		}
+		c = stop + 2;
+	}
+	if (len < 2) {
+		return (false);
+	}
+
+	// Characters, or numbers zero-padded if a bound starts with 0
+	group->alpha = isalpha(bound[0][0]) && bound[0][1] == '\0' &&
+			isalpha(bound[1][0]) && bound[1][1] == '\0';
+	group->width = 0;
+	if (group->alpha) {
+		value[0] = bound[0][0];
+		value[1] = bound[1][0];
+	} else if (parseNumber(bound[0], -MAX_BRACE_SEQ, MAX_BRACE_SEQ, &value[0]) &&
+			parseNumber(bound[1], -MAX_BRACE_SEQ, MAX_BRACE_SEQ, &value[1])) {
+		for (int i=0; i<2; i++) {
+			char* digits = bound[i] + (bound[i][0] == '-');
+			if (digits[0] == '0' && digits[1] != '\0') {
+				group->width = strlen(bound[0]) > strlen(bound[1]) ?
+						strlen(bound[0]) : strlen(bound[1]);
+			}
+		}
+	} else {
+		return (false);
+	}
+	if (len == 3 && !parseNumber(bound[2], -MAX_BRACE_SEQ, MAX_BRACE_SEQ,
+			&value[2])) {
+		return (false);
+	}
+
+	// Count towards the last bound, whatever the sign of the step
+	group->seq = true;
+	group->from = value[0];
+	group->step = value[2] ? labs(value[2]) : 1;
+	if (value[0] > value[1]) {
+		group->step = -group->step;
+	}
+	group->count = (uint64_t)labs(value[1] - value[0]) / labs(group->step) + 1;
+	return (true);
+}
+
+
+/**
+ * @brief Find the brace groups of a word, and start generating its words.
+ *
+ * @param	gen		Generator to set up
+ * @param	word	Word to expand
+ * @return	True if the word has brace groups, false if it is kept as is
+ */
+bool initBraces(struct BraceGen* gen, char* word) {
+	gen->word = word;
+	gen->len = 0;
+	gen->done = false;
+
+	char* c = word;
+	while (gen->len < MAX_BRACE_GROUPS && (c = strchr(c, '{'))) {
+		// Braces are not nested, so start over from an inner opening brace
+		char* end = strpbrk(c + 1, "{}");
+		if (!end) {
+			break;
+		} else if (*end == '{') {
+			c = end;
+			continue;
+		}
+
+		struct BraceGroup* group = &gen->group[gen->len];
+		group->start = c;
+		group->end = end;
+		group->seq = false;
+		group->pos = 0;
+		group->item = c + 1;
+		if (memchr(c, ',', end - c)) {	// List
+			group->count = 1;
+			for (char* i=c+1; i<end; i++) {
+				group->count += *i == ',';
+			}
+			gen->len++;
+		} else if (parseBraceSeq(group)) {	// Sequence
+			gen->len++;
+		}
+		c = end + 1;
+	}
+	return (gen->len > 0);
+}
+
+
+/**
+ * @brief Generate the next word of a brace expansion.
+ *
+ * @param	gen	Generator set up by initBraces()
+ * @param	buf	Returns the word, MAX_BRACE_ITEM_LEN+1 chars at most
+ * @return	True if a word was generated, false if all of them were
+ */
+bool nextBrace(struct BraceGen* gen, char* buf) {
+	if (gen->done) {
+		return (false);
+	}
+
+	// Build the word from the current item of each group
+	char* out = buf;
+	char* text = gen->word;
+	for (int i=0; i<gen->len; i++) {
+		struct BraceGroup* group = &gen->group[i];
+		memcpy(out, text, group->start - text);
+		out += group->start - text;
+		if (!group->seq) {
+			size_t len = strcspn(group->item, ",}");
+			memcpy(out, group->item, len);
+			out += len;
+		} else if (group->alpha) {
+			*out++ = (char)(group->from + (long)group->pos * group->step);
+		} else {
+			out += sprintf(out, "%0*ld", group->width,
+					group->from + (long)group->pos * group->step);
+		}
+		text = group->end + 1;
+	}
+	strcpy(out, text);
+
+	// Move to the next item, the last group first
+	int i;
+	for (i=gen->len-1; i>=0; i--) {
+		struct BraceGroup* group = &gen->group[i];
+		if (++group->pos < group->count) {
+			if (!group->seq) {
+				group->item += strcspn(group->item, ",}") + 1;
+			}
+			break;
+		}
+		group->pos = 0;
+		group->item = group->start + 1;
+	}
+	gen->done = i < 0;
+	return (true);
+}
+
+
+/**
+ * @brief Get the room left for the arguments of a new program.
+ *
+ * Like the kernel, every argument takes its length, its NULL char and its
+ * pointer. The room taken by the environment, which children inherit, is
+ * taken off ARG_MAX.
+ *
+ * @return	Max bytes of arguments
+ */
+size_t argLimit() {
+	long arg_max = sysconf(_SC_ARG_MAX);
+	size_t limit = arg_max > 0 ? arg_max : _POSIX_ARG_MAX;
+
+	for (char** env=environ; *env; env++) {
+		size_t len = strlen(*env) + 1 + sizeof(char*);
+		limit = limit > len ? limit - len : 0;
+	}
+	return (limit > 2 * sizeof(char*) ? limit - 2 * sizeof(char*) : 0);
+}
+
+
+/**
+ * @brief Size the arguments of a command after brace expansion.
+ *
+ * The words are generated without keeping them, and sizing stops as soon as
+ * the limit is passed, so a huge range fails fast.
+ *
+ * @param	argv	Arguments of the command
+ * @param	limit	Max bytes of arguments, @sa argLimit()
+ * @param	argc	Returns the number of arguments
+ * @param	bytes	Returns the length of the arguments, with NULL chars
+ * @return	True if the arguments fit in the limit, false otherwise
+ */
+bool sizeArgs(char** argv, size_t limit, size_t* argc, size_t* bytes) {
+	struct BraceGen gen;
+	char buf[MAX_BRACE_ITEM_LEN+1];
+
+	*argc = 0;
+	*bytes = 0;
+	for (int i=0; argv[i]; i++) {
+		if (!strchr(argv[i], '{') || !initBraces(&gen, argv[i])) {
+			(*argc)++;
+			*bytes += strlen(argv[i]) + 1;
+		} else {
+			while (*bytes + *argc * sizeof(char*) <= limit &&
+					nextBrace(&gen, buf)) {
+				(*argc)++;
+				*bytes += strlen(buf) + 1;
+			}
+		}
+		if (*bytes + *argc * sizeof(char*) > limit) {
+			return (false);
+		}
+	}
+	return (true);
+}
+
+
+/**
+ * @brief Expand the brace groups of the arguments of a command.
+ *
+ * Called by the child processes right before exec(), so the shell never holds
+ * the expanded arguments. The arguments are sized first, and the words are
+ * then generated straight into an arena of that size.
+ *
+ * @param	argv	Arguments of the command
+ * @return	Expanded arguments, `argv` if there is nothing to expand, or NULL
+ * 			on error (the error is printed)
+ */
+char** expandArgs(char** argv) {
+	const char ARGS_ERR[MAX_ERROR_LEN] = "argument list too long\0";
+	const char ALLOC_ERR[MAX_ERROR_LEN] = "could not expand arguments\0";
+	struct BraceGen gen;
+	size_t argc;
+	size_t bytes;
+
+	// Keep the arguments if there is nothing to expand
+	bool braces = false;
+	for (int i=0; argv[i] && !braces; i++) {
+		braces = strchr(argv[i], '{') && initBraces(&gen, argv[i]);
+	}
+	if (!braces) {
+		return (argv);
+	}
+
+	if (!sizeArgs(argv, argLimit(), &argc, &bytes)) {
+		dprintf(STDERR_FILENO, "-yash: %s\n", ARGS_ERR);
+		return (NULL);
+	}
+	char** args = malloc((argc + 1) * sizeof(char*) + bytes);
+	if (!args) {
+		dprintf(STDERR_FILENO, "-yash: %s\n", ALLOC_ERR);
+		return (NULL);
+	}
+
+	// The arguments without braces are not copied
+	char* arena = (char*)&args[argc+1];
+	size_t len = 0;
+	for (int i=0; argv[i]; i++) {
+		if (!strchr(argv[i], '{') || !initBraces(&gen, argv[i])) {
+			args[len++] = argv[i];
+			continue;
+		}
+		while (nextBrace(&gen, arena)) {
+			args[len++] = arena;
+			arena += strlen(arena) + 1;
+		}
+	}
+	args[len] = NULL;
+	return (args);
+}
+
+
 /**
  * @brief Parse a command.
  *
@@ -233,6 +1688,10 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 	const char E_REDIR_OPT[3] = "2>\0";
 	const char BG_OPT[2] = "&\0";
 	const char PIPE_OPT[2] = "|\0";
+	const char HERE_DOC_OPT[3] = "<<\0";
+	const char HERE_STR_OPT[4] = "<<<\0";
+	const char I_PSUB_OPT[3] = "<(\0";
+	const char O_PSUB_OPT[3] = ">(\0";
 	const char SYNTAX_ERR_1[MAX_ERROR_LEN] = "syntax error: command should not"
 			" start with \0";
 	const char SYNTAX_ERR_2[MAX_ERROR_LEN] = "syntax error: near token \0";
@@ -240,17 +1699,23 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 			" end with \0";
 	const char SYNTAX_ERR_4[MAX_ERROR_LEN] = "syntax error: & should be the last"
 			" token of the command\0";
+	const char ARGS_ERR[MAX_ERROR_LEN] = "argument list too long after brace"
+			" expansion\0";
 
 	// Save and tokenize command string
 	strcpy(job_arr[*last_job].cmd_str, cmd_str);
 	tokenizeString(&job_arr[*last_job]);
 
+	// Skip the scheduling prefixes of the job
+	uint32_t first_tok = 0;
+	parseSchedPrefix(&job_arr[*last_job], &first_tok);
+
 	/*
 	 * Iterate over all tokens to look for arguments, redirection directives,
 	 * pipes and background directives
 	 */
 	int cmd_count = 0;	// Command array counter
-	for (uint32_t i=0; i<job_arr[*last_job].cmd_tok_len; i++) {
+	for (uint32_t i=first_tok; i<job_arr[*last_job].cmd_tok_len; i++) {
 		if (!strcmp(I_REDIR_OPT, job_arr[*last_job].cmd_tok[i])) {	// Check for input redir
 			// Check if redirection token has the correct syntax
 			if (i <= 0 || cmd_count <= 0) {	// Check it is not the first token
@@ -271,7 +1736,13 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 				return;
 			} else {	// Correct syntax
 				i++;	// Move ahead one iter to get the redir argument
-				if (!job_arr[*last_job].pipe) {
+				if (!strncmp(I_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2) ||
+						!strncmp(O_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2)) {	// Process substitution
+					uint8_t stage = job_arr[*last_job].pipe ? 2 : 1;
+					if (!parseProcSub(&job_arr[*last_job], &i, stage, PSUB_REDIR_IN)) {
+						return;
+					}
+				} else if (!job_arr[*last_job].pipe) {
 					strcpy(job_arr[*last_job].in1, job_arr[*last_job].cmd_tok[i]);
 				} else {
 					strcpy(job_arr[*last_job].in2, job_arr[*last_job].cmd_tok[i]);
@@ -297,7 +1768,13 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 				return;
 			} else {	// Correct syntax
 				i++;	// Move ahead one iter to get the redir argument
-				if (!job_arr[*last_job].pipe) {
+				if (!strncmp(I_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2) ||
+						!strncmp(O_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2)) {	// Process substitution
+					uint8_t stage = job_arr[*last_job].pipe ? 2 : 1;
+					if (!parseProcSub(&job_arr[*last_job], &i, stage, PSUB_REDIR_OUT)) {
+						return;
+					}
+				} else if (!job_arr[*last_job].pipe) {
 					strcpy(job_arr[*last_job].out1, job_arr[*last_job].cmd_tok[i]);
 				} else {
 					strcpy(job_arr[*last_job].out2, job_arr[*last_job].cmd_tok[i]);
@@ -323,7 +1800,13 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 				return;
 			} else {	// Correct syntax
 				i++;	// Move ahead one iter to get the redir argument
-				if (!job_arr[*last_job].pipe) {
+				if (!strncmp(I_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2) ||
+						!strncmp(O_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2)) {	// Process substitution
+					uint8_t stage = job_arr[*last_job].pipe ? 2 : 1;
+					if (!parseProcSub(&job_arr[*last_job], &i, stage, PSUB_REDIR_ERR)) {
+						return;
+					}
+				} else if (!job_arr[*last_job].pipe) {
 					strcpy(job_arr[*last_job].err1, job_arr[*last_job].cmd_tok[i]);
 				} else {
 					strcpy(job_arr[*last_job].err2, job_arr[*last_job].cmd_tok[i]);
@@ -359,8 +1842,58 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 			} else {
 				job_arr[*last_job].bg = true;
 			}
-		} else {	// Command argument
-			if (!job_arr[*last_job].pipe) {
+		} else if (!strncmp(HERE_DOC_OPT, job_arr[*last_job].cmd_tok[i], 2)) {	// Here-doc or here-string
+			uint8_t type = HERE_DOC;
+			char* word = job_arr[*last_job].cmd_tok[i] + strlen(HERE_DOC_OPT);
+			if (!strncmp(HERE_STR_OPT, job_arr[*last_job].cmd_tok[i], 3)) {
+				type = HERE_STR;
+				word = job_arr[*last_job].cmd_tok[i] + strlen(HERE_STR_OPT);
+			}
+
+			// Check if here-document token has the correct syntax
+			if (i <= 0 || cmd_count <= 0) {	// Check it is not the first token
+				strcpy(job_arr[*last_job].err_msg, SYNTAX_ERR_1);
+				strcat(job_arr[*last_job].err_msg, job_arr[*last_job].cmd_tok[i]);
+				return;
+			} else if (!strcmp(word, EMPTY_STR)) {	// Word in the next token
+				if (i >= job_arr[*last_job].cmd_tok_len-1) {	// Check it is not the last token
+					strcpy(job_arr[*last_job].err_msg, SYNTAX_ERR_3);
+					strcat(job_arr[*last_job].err_msg, job_arr[*last_job].cmd_tok[i]);
+					return;
+				} else if (!strcmp(PIPE_OPT, job_arr[*last_job].cmd_tok[i+1]) ||
+						!strcmp(BG_OPT, job_arr[*last_job].cmd_tok[i+1])) {	// Check there is an argument after this token
+					strcpy(job_arr[*last_job].err_msg, SYNTAX_ERR_2);
+					strcat(job_arr[*last_job].err_msg, job_arr[*last_job].cmd_tok[i]);
+					return;
+				}
+				i++;	// Move ahead one iter to get the word
+				word = job_arr[*last_job].cmd_tok[i];
+			}
+
+			if (!job_arr[*last_job].pipe) {
+				job_arr[*last_job].here1 = word;
+				job_arr[*last_job].here1_type = type;
+			} else {
+				job_arr[*last_job].here2 = word;
+				job_arr[*last_job].here2_type = type;
+			}
+		} else if (!strncmp(I_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2) ||
+				!strncmp(O_PSUB_OPT, job_arr[*last_job].cmd_tok[i], 2)) {	// Process substitution
+			uint8_t stage = job_arr[*last_job].pipe ? 2 : 1;
+			if (!parseProcSub(&job_arr[*last_job], &i, stage, PSUB_ARG)) {
+				return;
+			}
+
+			// The argument is the /dev/fd path set up when running the job
+			char* path = job_arr[*last_job].psub[job_arr[*last_job].psub_len-1].path;
+			if (!job_arr[*last_job].pipe) {
+				job_arr[*last_job].cmd1[cmd_count] = path;
+			} else {
+				job_arr[*last_job].cmd2[cmd_count] = path;
+			}
+			cmd_count++;
+		} else {	// Command argument
+			if (!job_arr[*last_job].pipe) {
 				job_arr[*last_job].cmd1[cmd_count] = job_arr[*last_job].cmd_tok[i];
 				cmd_count++;
 			} else {
@@ -369,6 +1902,188 @@ void parseJob(char* cmd_str, struct Job job_arr[], int* last_job) {
 			}
 		}
 	}
+
+	// Check the arguments still fit in ARG_MAX after brace expansion
+	if (strchr(cmd_str, '{')) {
+		size_t limit = argLimit();
+		size_t argc;
+		size_t bytes;
+		if (!sizeArgs(job_arr[*last_job].cmd1, limit, &argc, &bytes) ||
+				!sizeArgs(job_arr[*last_job].cmd2, limit, &argc, &bytes)) {
+			strcpy(job_arr[*last_job].err_msg, ARGS_ERR);
+			return;
+		}
+	}
+}
+
+
+/**
+ * @brief Write content to a here-document buffer.
+ *
+ * If the content does not fit in the pipe buffer any more, the content already
+ * in the pipe is moved to a new memfd_create() file, and the rest is written
+ * there. The pipe is non-blocking, so a full buffer is detected without
+ * blocking the shell.
+ *
+ * @param	buf		Here-document buffer
+ * @param	data	Content to write
+ * @param	len		Length of the content
+ * @return	True on success, false on error (errno is set)
+ */
+bool writeHereBuf(struct HereBuf* buf, const char* data, size_t len) {
+	char chunk[BUFSIZ];
+	size_t done = 0;
+
+	// Write to the pipe until its buffer is full
+	while (!buf->mem && done < len) {
+		ssize_t n = write(buf->wfd, data + done, len - done);
+		if (n == SYSCALL_RETURN_ERR && errno != EAGAIN) {
+			return false;
+		} else if (n == SYSCALL_RETURN_ERR) {
+			// Too big for the pipe: spill the content to an in-memory file
+			int mfd = memfd_create("yash-heredoc", MFD_CLOEXEC);
+			if (mfd == SYSCALL_RETURN_ERR) {
+				return false;
+			}
+
+			close(buf->wfd);
+			buf->wfd = NO_FD;
+			while ((n = read(buf->fd, chunk, sizeof(chunk))) > 0) {
+				if (write(mfd, chunk, n) != n) {
+					close(mfd);
+					return false;
+				}
+			}
+			close(buf->fd);
+			buf->fd = mfd;
+			buf->mem = true;
+		} else {
+			done += n;
+		}
+	}
+
+	// Write the rest to the in-memory file, retrying on short writes
+	while (done < len) {
+		ssize_t n = write(buf->fd, data + done, len - done);
+		if (n == SYSCALL_RETURN_ERR) {
+			return false;
+		}
+		done += n;
+	}
+	buf->len += len;
+
+	return true;
+}
+
+
+/**
+ * @brief Load a here-document or here-string to an in-memory file.
+ *
+ * A here-string is the word followed by a newline. A here-document is read line
+ * by line from the input until a line equal to the delimiter, or EOF.
+ *
+ * The content is written to a pipe when it fits in the pipe buffer, or to a
+ * memfd_create() file otherwise, so no temporary file is ever created.
+ *
+ * @param	cmd		Command to set the error message on
+ * @param	word	Here-document delimiter or here-string
+ * @param	type	HERE_DOC or HERE_STR
+ * @param	fd		Returns the descriptor to read the content from
+ * @return	True on success, false on error (`cmd.err_msg` is set)
+ *
+ * @sa HereBuf
+ */
+bool openHereDoc(struct Job* cmd, char* word, uint8_t type, int* fd) {
+	const char HERE_ERR_1[MAX_ERROR_LEN] = "here-document errno ";
+	const char HERE_ERR_2[MAX_ERROR_LEN] = ": could not load content for: ";
+	extern errno;
+	char errno_str[sizeof(int)*8+1];
+	int hfd[2];
+	bool ok = true;
+
+	if (pipe2(hfd, O_CLOEXEC) == SYSCALL_RETURN_ERR) {
+		ok = false;
+	} else {
+		struct HereBuf buf = { hfd[0], hfd[1], 0, false };
+		fcntl(hfd[1], F_SETFL, O_NONBLOCK);
+
+		if (type == HERE_STR) {
+			ok = writeHereBuf(&buf, word, strlen(word)) &&
+					writeHereBuf(&buf, "\n", 1);
+		} else {
+			char* line;
+			while (ok && (line = readLine(HERE_DOC_PROMPT))) {
+				if (!strcmp(line, word)) {
+					free(line);
+					break;
+				}
+				ok = writeHereBuf(&buf, line, strlen(line)) &&
+						writeHereBuf(&buf, "\n", 1);
+				free(line);
+			}
+		}
+
+		// Make the content readable from the start
+		if (buf.mem) {
+			lseek(buf.fd, 0, SEEK_SET);
+		} else {
+			close(buf.wfd);
+		}
+		*fd = buf.fd;
+		if (!ok) {
+			close(buf.fd);
+		}
+	}
+
+	if (!ok) {
+		sprintf(errno_str, "%d", errno);
+		strcpy(cmd->err_msg, HERE_ERR_1);
+		strcat(cmd->err_msg, errno_str);
+		strcat(cmd->err_msg, HERE_ERR_2);
+		strcat(cmd->err_msg, word);
+		*fd = NO_FD;
+	}
+
+	return ok;
+}
+
+
+/**
+ * @brief Load the here-documents and here-strings of a job.
+ *
+ * @param	cmd	Command with the here-documents
+ * @return	True on success, false on error (`cmd.err_msg` is set)
+ */
+bool openHereDocs(struct Job* cmd) {
+	if (cmd->here1_type != HERE_NONE &&
+			!openHereDoc(cmd, cmd->here1, cmd->here1_type, &cmd->here1_fd)) {
+		return false;
+	}
+	if (cmd->here2_type != HERE_NONE &&
+			!openHereDoc(cmd, cmd->here2, cmd->here2_type, &cmd->here2_fd)) {
+		closeHereDocs(cmd, 0);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Close the here-document descriptors not used by a process.
+ *
+ * @param	cmd			Command with the here-documents
+ * @param	keep_stage	Stage whose here-document is kept open (1, 2 or 0)
+ */
+void closeHereDocs(struct Job* cmd, uint8_t keep_stage) {
+	if (keep_stage != 1 && cmd->here1_fd != NO_FD) {
+		close(cmd->here1_fd);
+		cmd->here1_fd = NO_FD;
+	}
+	if (keep_stage != 2 && cmd->here2_fd != NO_FD) {
+		close(cmd->here2_fd);
+		cmd->here2_fd = NO_FD;
+	}
 }
 
 
@@ -403,6 +2118,12 @@ void redirectSimple(struct Job* cmd) {
 		close(i1fd);
 	}
 
+	// Here-document or here-string input
+	if (cmd->here1_fd != NO_FD) {
+		dup2(cmd->here1_fd, STDIN_FILENO);
+		close(cmd->here1_fd);
+	}
+
 	// Output redirection
 	if (strcmp(cmd->out1, EMPTY_STR)) {
 		// Create output file
@@ -473,6 +2194,12 @@ void redirectPipe(struct Job* cmd) {
 		close(i2fd);
 	}
 
+	// Here-document or here-string input
+	if (cmd->pipe && cmd->here2_fd != NO_FD) {
+		dup2(cmd->here2_fd, STDIN_FILENO);
+		close(cmd->here2_fd);
+	}
+
 	// Output redirection
 	if (cmd->pipe && strcmp(cmd->out2, EMPTY_STR)) {
 		//
@@ -515,356 +2242,3060 @@ void redirectPipe(struct Job* cmd) {
 
 
 /**
- * @brief Set up signal handling to relay signals to children processes.
+ * @brief Create the pipes of the process substitutions of a job.
  *
- * This function is based on the UT Austin EE 382V Systems Programming class
- * examples posted by Dr. Ramesh Yerraballi.
- *
- * TODO: Add support for job control.
+ * The end of each pipe used by the job stage is saved in the `fd` of the
+ * substitution, and its `path` is set to `/dev/fd/N`, also copied to the
+ * redirection of the stage it is the target of, if any. The other end is saved
+ * in `peer_fds`, to be used by the substitution process.
  *
- * @param cmd	Parsed command
+ * @param	cmd			Command with the process substitutions
+ * @param	peer_fds	Array of MAX_PROC_SUBS to save the substitution ends
+ * @return	True on success, false on error (`cmd.err_msg` is set)
  */
-void waitForChildren(struct Job* cmd) {
-	const char SIG_ERR_1[MAX_ERROR_LEN] = "signal errno ";
-	const char SIG_ERR_2[MAX_ERROR_LEN] = ": waitpid error";
+bool openProcSubs(struct Job* cmd, int peer_fds[]) {
+	const char PIPE_ERR_1[MAX_ERROR_LEN] = "pipe errno ";
+	const char PIPE_ERR_2[MAX_ERROR_LEN] = ": failed to make process substitution pipe";
 	extern errno;
 	char errno_str[sizeof(int)*8+1];
+	int psfd[2];
 
-	int status;
-	uint8_t count = 0;
-	int child_num;
-
-	// Determine the number of child processes
-	if (cmd->pipe) {
-		child_num = CHILD_COUNT_PIPE;
-	} else {
-		child_num = CHILD_COUNT_SIMPLE;
-	}
-
-	// Wait for child to exit
-	while (count < child_num) {
-		/**
-		 * TODO: Fix EINTR (4) error
-		 *
-		 * This snippet always throws the EINTR (4) error code. The
-		 * documentation for waitpid (3) says EINTR means: "WNOHANG was not set
-		 * and an unblocked signal or a SIGCHLD was caught; see signal(7)."
-		 *
-		 * TODO: Fix WCONTINUED compilation error
-		 *
-		 * See this for error description: https://stackoverflow.com/questions/
-		 * 60101242/compiler-error-using-wcontinued-option-for-waitpid
-		 */
-		//if (waitpid(-1, &status, WUNTRACED|WCONTINUED) == SYSCALL_RETURN_ERR) {
-		if (waitpid(job_arr[last_job].gpid, &status, WUNTRACED) == SYSCALL_RETURN_ERR) {
+	for (uint8_t i=0; i<cmd->psub_len; i++) {
+		if (pipe(psfd) == SYSCALL_RETURN_ERR) {
 			sprintf(errno_str, "%d", errno);
-			strcpy(cmd->err_msg, SIG_ERR_1);
+			strcpy(cmd->err_msg, PIPE_ERR_1);
 			strcat(cmd->err_msg, errno_str);
-			strcat(cmd->err_msg, SIG_ERR_2);
-			return;
+			strcat(cmd->err_msg, PIPE_ERR_2);
+
+			// Close the pipes already created
+			cmd->psub_len = i;
+			closeProcSubs(cmd, peer_fds, 0);
+			return false;
 		}
 
-		if (WIFEXITED(status)) {
-			if (verbose) {
-				printf("-yash: child process terminated normally\n");
-			}
-			count++;
-		} else if (WIFSIGNALED(status)) {
-			printf("\n");	// Ensure there is an space after "^C"
-			if (verbose) {
-				printf("-yash: child process terminated by a signal\n");
-			}
-			count++;
-		} else if (WIFSTOPPED(status)) {
-			printf("\n");	// Ensure there is an space after "^Z"
-			if (verbose) {
-				printf("-yash: child process stopped by a signal\n");
-			}
-			//
-		} /*else if (WIFCONTINUED(status)) {
-			//
-		}*/
+		if (cmd->psub[i].out) {	// The stage writes, the substitution reads
+			cmd->psub[i].fd = psfd[1];
+			peer_fds[i] = psfd[0];
+		} else {	// The substitution writes, the stage reads
+			cmd->psub[i].fd = psfd[0];
+			peer_fds[i] = psfd[1];
+		}
+		snprintf(cmd->psub[i].path, PROC_SUB_PATH_LEN, "/dev/fd/%d",
+				cmd->psub[i].fd);
+
+		// A redirection target takes the path instead of a file name
+		bool first = (cmd->psub[i].stage == 1);
+		if (cmd->psub[i].redir == PSUB_REDIR_IN) {
+			strcpy(first ? cmd->in1 : cmd->in2, cmd->psub[i].path);
+		} else if (cmd->psub[i].redir == PSUB_REDIR_OUT) {
+			strcpy(first ? cmd->out1 : cmd->out2, cmd->psub[i].path);
+		} else if (cmd->psub[i].redir == PSUB_REDIR_ERR) {
+			strcpy(first ? cmd->err1 : cmd->err2, cmd->psub[i].path);
+		}
 	}
+
+	return true;
 }
 
 
 /**
- * @brief Execute commands.
- *
- * This function allows for both simple and piped commands (1 pipe only).
- * Moreover, the command is checked for correctness, and ignored if it does not
- * exist.
- *
- * This function is based on the UT Austin EE 382V Systems Programming class
- * examples by Dr. Ramesh Yerraballi.
+ * @brief Close the process substitution pipes not used by a process.
  *
- * TODO: Add support for job control.
+ * All the substitution ends in `peer_fds` are closed, as well as the stage
+ * ends of the substitutions not used by `keep_stage`. Use `keep_stage` 0 to
+ * close all the pipes.
  *
- * @param	job_arr	Jobs list of parsed commands
- * @param	last_job	Last job added to the job_arr
+ * @param	cmd			Command with the process substitutions
+ * @param	peer_fds	Substitution ends of the pipes
+ * @param	keep_stage	Stage whose pipe ends are kept open (1, 2 or 0)
  */
-void runJob(struct Job job_arr[], int* last_job) {
-	const char PIPE_ERR_1[MAX_ERROR_LEN] = "pipe errno ";
-	const char PIPE_ERR_2[MAX_ERROR_LEN] = ": failed to make pipe";
-	extern errno;
-	char errno_str[sizeof(int)*8+1];
-
-	pid_t c1_pid, c2_pid;
-	int pfd[2];
-	int stdout_fd;
-
-	if (job_arr[*last_job].pipe) {
-		stdout_fd = dup(STDOUT_FILENO);	// Save stdout
-
-		if (pipe(pfd) == SYSCALL_RETURN_ERR) {
-			sprintf(errno_str, "%d", errno);
-			strcpy(job_arr[*last_job].err_msg, PIPE_ERR_1);
-			strcat(job_arr[*last_job].err_msg, errno_str);
-			strcat(job_arr[*last_job].err_msg, PIPE_ERR_2);
-			return;
+void closeProcSubs(struct Job* cmd, int peer_fds[], uint8_t keep_stage) {
+	for (uint8_t i=0; i<cmd->psub_len; i++) {
+		close(peer_fds[i]);
+		if (cmd->psub[i].stage != keep_stage) {
+			close(cmd->psub[i].fd);
 		}
 	}
+}
 
-	c1_pid = fork();
-
-	if (c1_pid == 0) {	// Child 1 or left child process
-		// Create a new session and a new group, and become group leader
-		setpgid(0, 0);
-
-		// Set up signal handling sent to the children process group
-		if (verbose) {
-			printf("-yash: children process group: ignoring signal SIGTTOU, "
-					"but getting all the others\n");
-		}
-		signal(SIGTTOU, SIG_IGN);
-		signal(SIGINT, SIG_DFL);
-		signal(SIGTSTP, SIG_DFL);
-		signal(SIGCHLD, SIG_DFL);
-
-		if (job_arr[*last_job].pipe) {
-			close(pfd[0]);	// Close unused read end
-			dup2(pfd[1], STDOUT_FILENO);	// Make output go to pipe
-		}
-		// Do additional redirection if necessary
-		redirectSimple(&job_arr[*last_job]);
-		if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
-			if (job_arr[*last_job].pipe) {
-				dup2(stdout_fd, STDOUT_FILENO);	// Allow to write to stdout
-			}
-			printf("-yash: %s\n", job_arr[*last_job].err_msg);
-			exit(EXIT_ERR_CMD);
-		}
-
-		// Execute command
-		if (execvp(job_arr[*last_job].cmd1[0], job_arr[*last_job].cmd1) == SYSCALL_RETURN_ERR
-				&& verbose) {
-			printf("-yash: execvp() errno: %d\n", errno);
-		}
-		// Make sure we terminate child on execvp() error
-		exit(EXIT_ERR_CMD);
-	} else {	// Parent process
-		if (job_arr[*last_job].pipe) {
-			c2_pid = fork();
-
-			if (c2_pid == 0) {	// Child 2 or right child process
-				// Join the group created by child 1
-				setpgid(0, c1_pid);
 
-				// Set up signal handling sent to the children process group
-				if (verbose) {
-					printf("-yash: children process group: ignoring signal SIGTTOU, "
-							"but getting all the others\n");
-				}
-				signal(SIGTTOU, SIG_IGN);
-				signal(SIGINT, SIG_DFL);
-				signal(SIGTSTP, SIG_DFL);
+/**
+ * @brief Start the process substitutions of a job.
+ *
+ * This function must be called from the parent after the job process group
+ * has been created. Each substitution runs in its own child process in the
+ * job process group, connected to its stage through the pipe created by
+ * openProcSubs(). The children are counted in `cmd.child_count`, so they are
+ * reaped with the rest of the job.
+ *
+ * @param	cmd			Command with the process substitutions
+ * @param	peer_fds	Substitution ends of the pipes
+ * @param	pfd			Pipe between the job stages, if any
+ */
+void runProcSubs(struct Job* cmd, int peer_fds[], int pfd[]) {
+	flushOutput();
+	for (uint8_t i=0; i<cmd->psub_len; i++) {
+		pid_t pid = fork();
 
-				close(pfd[1]);	// Close unused write end
-				dup2(pfd[0], STDIN_FILENO);	// Get input from pipe
+		if (pid == 0) {	// Process substitution child
+			setpgid(0, cmd->gpid);
 
-				// Do additional redirection if necessary
-				redirectPipe(&job_arr[*last_job]);
-				if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
-					dup2(stdout_fd, STDOUT_FILENO);	// Allow to write to stdout
-					printf("-yash: %s\n", job_arr[*last_job].err_msg);
-					exit(EXIT_ERR_CMD);
-				}
+			resetChildSignals();
 
-				// Execute command
-				if (execvp(job_arr[*last_job].cmd2[0], job_arr[*last_job].cmd2) == SYSCALL_RETURN_ERR
-						&& verbose) {
-					printf("-yash: execvp() errno: %d\n", errno);
-				}
-				// Make sure we terminate child on execvp() error
+			if (!applySched(cmd, 0)) {
+				printf("-yash: %s\n", cmd->err_msg);
 				exit(EXIT_ERR_CMD);
 			}
-			// Parent process. Close pipes so EOF can work
-			close(pfd[0]);
-			close(pfd[1]);
-			close(stdout_fd);
-		}
 
-		// Parent process
-		// Save job gpid
-		job_arr[*last_job].gpid = c1_pid;
-		if (!job_arr[*last_job].bg) {
-			// Give terminal control to child
-			if (verbose) {
-				printf("-yash: "
-						"giving terminal control to child process group\n");
+			// Connect the substitution end of the pipe
+			if (cmd->psub[i].out) {
+				dup2(peer_fds[i], STDIN_FILENO);
+			} else {
+				dup2(peer_fds[i], STDOUT_FILENO);
 			}
-			tcsetpgrp(0, c1_pid);
 
-			// Block while waiting for children
-			waitForChildren(&job_arr[*last_job]);
-			if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
-				return;
+			// Close the pipes of the job, so the stages get their EOF
+			if (cmd->pipe) {
+				close(pfd[0]);
+				close(pfd[1]);
 			}
+			closeProcSubs(cmd, peer_fds, 0);
+			closeHereDocs(cmd, 0);
 
-			// Get back terminal control to parent
-			if (verbose) {
-				printf("-yash: returning terminal control to parent process\n");
+			// Execute command
+			flushOutput();
+			char** argv = expandArgs(&cmd->psub_argv[cmd->psub[i].argv_idx]);
+			if (argv && execvp(argv[0], argv) == SYSCALL_RETURN_ERR && verbose) {
+				printf("-yash: execvp() errno: %d\n", errno);
 			}
-			tcsetpgrp(0, getpid());
-			removeJob(*last_job);	// Remove job from jobs table
+			// Make sure we terminate child on execvp() error
+			exit(EXIT_ERR_CMD);
 		}
+
+		// Parent process
+		setpgid(pid, cmd->gpid);
+		cmd->psub[i].pid = pid;
+		cmd->child_count++;
+		addJobProc(cmd, pid);
 	}
 }
 
 
 /**
- * @brief Handle new job.
+ * @brief Set the buffer size of a pipe.
  *
- * This function parses the raw input of the new job, adds the job to the jobs
- * table, and it executes the new job.
+ * The size is capped to the max size in /proc/sys/fs/pipe-max-size, read on the
+ * first call.
+ *
+ * @param	fd		Any end of the pipe
+ * @param	size	New buffer size in bytes
+ * @return	Buffer size set, or SYSCALL_RETURN_ERR on error
+ */
+int setPipeSize(int fd, int size) {
+	// Read the max pipe size once
+	if (pipe_max_size <= 0) {
+		FILE* max_file = fopen(PIPE_MAX_SIZE_PATH, "r");
+		if (!max_file || fscanf(max_file, "%d", &pipe_max_size) != 1) {
+			pipe_max_size = getpagesize() * 16;	// Linux default size
+		}
+		if (max_file) {
+			fclose(max_file);
+		}
+	}
+
+	if (size > pipe_max_size) {
+		size = pipe_max_size;
+	}
+
+	int new_size = fcntl(fd, F_SETPIPE_SZ, size);
+	if (new_size == SYSCALL_RETURN_ERR && verbose) {
+		printf("-yash: could not set pipe size to %d: errno %d\n", size, errno);
+	}
+	return new_size;
+}
+
+
+/**
+ * @brief Grow the pipe of a job if the left stage blocks on it.
+ *
+ * The pipe is opened through /proc from the left stage, and its fill level is
+ * checked. If it is full for PIPE_FULL_SAMPLES calls in a row, the left stage
+ * is most likely blocked waiting for the right stage, and the buffer size is
+ * doubled.
+ *
+ * The shell does not keep any end of the pipe open, so that the stages still
+ * get their EOF and SIGPIPE.
+ *
+ * @param	cmd	Command with the pipe
+ */
+void tunePipe(struct Job* cmd) {
+	char path[PROC_SUB_PATH_LEN+8];
+	struct stat pipe_stat;
+	int used;
+
+	if (!cmd->pipe || cmd->pids[0] <= 0 ||
+			(!cmd->pipe_auto && !shell_opts[OPT_PIPEAUTO].value)) {
+		return;
+	}
+
+	// Open the pipe from the stdout of the left stage
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", cmd->pids[0], STDOUT_FILENO);
+	int fd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if (fd == SYSCALL_RETURN_ERR) {
+		return;
+	}
+
+	// Check it is still the pipe of the job, and sample its fill level
+	int size = fcntl(fd, F_GETPIPE_SZ);
+	if (fstat(fd, &pipe_stat) != SYSCALL_RETURN_ERR &&
+			pipe_stat.st_ino == cmd->pipe_ino && size > 0 &&
+			ioctl(fd, FIONREAD, &used) != SYSCALL_RETURN_ERR) {
+		if (used < size) {
+			cmd->pipe_full = 0;
+		} else if (++cmd->pipe_full >= PIPE_FULL_SAMPLES) {
+			cmd->pipe_full = 0;
+			int new_size = setPipeSize(fd, size * 2);
+			if (verbose && new_size > size) {
+				printf("-yash: pipe size of job %d grown to %d\n", cmd->jobno,
+						new_size);
+			}
+		}
+	}
+	close(fd);
+}
+
+
+/**
+ * @brief Relay data between two pipes, measuring the throughput and stalls.
+ *
+ * Data is moved with non-blocking splice(), so it never goes through user
+ * space. When splice() would block, the input pipe is checked to know whether
+ * the relay waits for the producer (input empty) or the consumer (output full),
+ * and the time spent waiting is added to the statistics.
+ *
+ * @param	meter	Pipe statistics to update
+ * @param	in_fd	Read end of the pipe from the left stage
+ * @param	out_fd	Write end of the pipe to the right stage
+ */
+void relayPipe(struct PipeMeter* meter, int in_fd, int out_fd) {
+	int avail;
+
+	meter->start_ns = nowNs();
+	for (;;) {
+		ssize_t n = splice(in_fd, NULL, out_fd, NULL, METER_CHUNK,
+				SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			__atomic_add_fetch(&meter->bytes, n, __ATOMIC_RELAXED);
+			continue;
+		} else if (n == 0 || errno != EAGAIN) {	// EOF, or consumer gone
+			break;
+		}
+
+		// Wait for the side that blocks the relay
+		struct pollfd pfd = { in_fd, POLLIN, 0 };
+		if (ioctl(in_fd, FIONREAD, &avail) != SYSCALL_RETURN_ERR && avail > 0) {
+			pfd.fd = out_fd;
+			pfd.events = POLLOUT;
+		}
+		uint64_t wait_start = nowNs();
+		poll(&pfd, 1, -1);
+		uint64_t waited = nowNs() - wait_start;
+		if (pfd.fd == in_fd) {
+			__atomic_add_fetch(&meter->wait_in_ns, waited, __ATOMIC_RELAXED);
+		} else {
+			__atomic_add_fetch(&meter->wait_out_ns, waited, __ATOMIC_RELAXED);
+		}
+	}
+	meter->end_ns = nowNs();
+}
+
+
+/**
+ * @brief Start the helper process relaying a metered pipe.
+ *
+ * The helper runs in the job process group, and is counted in
+ * `cmd.child_count`, so it is reaped with the rest of the job. The statistics
+ * are kept in the anonymous shared mapping in `cmd.meter`.
+ *
+ * @param	cmd			Command with the metered pipe
+ * @param	pfd			Pipe from the left stage
+ * @param	mfd			Pipe to the right stage
+ * @param	peer_fds	Substitution ends of the process substitution pipes
+ *
+ * @sa relayPipe()
+ */
+void runPipeMeter(struct Job* cmd, int pfd[], int mfd[], int peer_fds[]) {
+	flushOutput();
+	pid_t pid = fork();
+	if (pid == 0) {	// Helper process
+		setpgid(0, cmd->gpid);
+
+		resetChildSignals();
+		signal(SIGPIPE, SIG_IGN);	// Get EPIPE when the right stage exits
+
+		// Keep only the ends to relay
+		close(pfd[1]);
+		close(mfd[0]);
+		closeProcSubs(cmd, peer_fds, 0);
+		closeHereDocs(cmd, 0);
+
+		relayPipe(cmd->meter, pfd[0], mfd[1]);
+		_exit(EXIT_OK);
+	}
+
+	// Parent process
+	setpgid(pid, cmd->gpid);
+	cmd->child_count++;
+	addJobProc(cmd, pid);
+}
+
+
+/**
+ * @brief Choose a CPU for each stage of a job.
+ *
+ * If the job has the `taskset -s` prefix, or the `cpuspread` shell option is
+ * set, each stage is assigned the next CPU out of the ones allowed for the job.
+ * The next CPU is kept across jobs, so consecutive jobs use different CPUs too.
+ *
+ * @param	cmd	Command to place
+ */
+void placeJob(struct Job* cmd) {
+	cpu_set_t allowed;
+	int stages = cmd->pipe ? CHILD_COUNT_PIPE : CHILD_COUNT_SIMPLE;
+
+	if (!cmd->sched.spread && !shell_opts[OPT_CPUSPREAD].value) {
+		return;
+	}
+
+	// Get the CPUs allowed for the job
+	if (cmd->sched.cpus_set) {
+		allowed = cmd->sched.cpus;
+	} else if (sched_getaffinity(0, sizeof(allowed), &allowed) == SYSCALL_RETURN_ERR) {
+		return;
+	}
+
+	for (int i=0; i<stages; i++) {
+		for (int n=0; n<CPU_SETSIZE; n++) {
+			int cpu = (next_cpu + n) % CPU_SETSIZE;
+			if (CPU_ISSET(cpu, &allowed)) {
+				cmd->sched.stage_cpu[i] = cpu;
+				next_cpu = cpu + 1;
+				break;
+			}
+		}
+	}
+	cmd->sched.spread = true;
+}
+
+
+/**
+ * @brief Apply the scheduling parameters of a job to the calling process.
+ *
+ * This function must be called from the child process, before exec().
+ *
+ * @param	cmd		Command with the scheduling parameters
+ * @param	stage	Stage run by the process (1 or 2), or 0 for other processes
+ * @return	True on success, false on error (`cmd.err_msg` is set)
+ *
+ * @sa SchedAttr, placeJob()
+ */
+bool applySched(struct Job* cmd, uint8_t stage) {
+	const char SCHED_ERR_1[MAX_ERROR_LEN] = "sched errno ";
+	const char SCHED_ERR_2[MAX_ERROR_LEN] = ": could not set ";
+	extern errno;
+	char errno_str[sizeof(int)*8+1];
+	const char* failed = NULL;
+	cpu_set_t cpus;
+
+	// CPU affinity
+	if (cmd->sched.spread && stage > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cmd->sched.stage_cpu[stage-1], &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) == SYSCALL_RETURN_ERR) {
+			failed = "CPU affinity";
+		}
+	} else if (cmd->sched.cpus_set &&
+			sched_setaffinity(0, sizeof(cmd->sched.cpus), &cmd->sched.cpus) == SYSCALL_RETURN_ERR) {
+		failed = "CPU affinity";
+	}
+
+	// Nice value
+	if (!failed && cmd->sched.nice_set) {
+		errno = 0;
+		if (nice(cmd->sched.nice) == SYSCALL_RETURN_ERR && errno) {
+			failed = "nice value";
+		}
+	}
+
+	// I/O priority
+	if (!failed && cmd->sched.ioprio_set &&
+			syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, cmd->sched.ioprio) == SYSCALL_RETURN_ERR) {
+		failed = "I/O priority";
+	}
+
+	if (failed) {
+		sprintf(errno_str, "%d", errno);
+		strcpy(cmd->err_msg, SCHED_ERR_1);
+		strcat(cmd->err_msg, errno_str);
+		strcat(cmd->err_msg, SCHED_ERR_2);
+		strcat(cmd->err_msg, failed);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Run a job stage spawned by the zygote, until exec().
+ *
+ * The stage shares the memory of the zygote, so it only sets up its own
+ * descriptors, signals and scheduling. Arguments with expanded braces are left
+ * in `stage.args` for the zygote to free.
+ *
+ * @param	data	Stage to run, @sa ZygoteStage
+ * @return	Never returns on success, exit status on error
+ */
+int runZygoteStage(void* data) {
+	static struct Job job;
+	struct ZygoteStage* stage = data;
+	struct ZygoteReq* req = stage->req;
+	char* argv[MAX_TOKEN_NUM];
+
+	setpgid(0, req->pgid);
+
+	resetChildSignals();
+	prctl(PR_SET_PDEATHSIG, 0);
+
+	// Set up the standard descriptors sent by the shell
+	for (int i=0; i<ZYGOTE_FDS; i++) {
+		dup2(stage->fds[i], i);
+	}
+	close(stage->sock);
+
+	// Rebuild the stage as a simple job to reuse the child setup
+	job.sched = req->sched;
+	job.here1_fd = NO_FD;
+	strcpy(job.in1, req->in);
+	strcpy(job.out1, req->out);
+	strcpy(job.err1, req->err);
+	strcpy(job.err_msg, EMPTY_STR);
+	argv[0] = req->argv;
+	for (uint32_t i=1; i<req->argc; i++) {
+		argv[i] = argv[i-1] + strlen(argv[i-1]) + 1;
+	}
+	argv[req->argc] = NULL;
+
+	if (applySched(&job, req->stage)) {
+		redirectSimple(&job);
+	}
+	if (strcmp(job.err_msg, EMPTY_STR)) {
+		dprintf(STDERR_FILENO, "-yash: %s\n", job.err_msg);
+		_exit(EXIT_ERR_CMD);
+	}
+
+	// Execute command
+	char** args = expandArgs(argv);
+	if (args != argv) {
+		stage->args = args;
+	}
+	if (args && execvp(args[0], args) == SYSCALL_RETURN_ERR && verbose) {
+		dprintf(STDERR_FILENO, "-yash: execvp() errno: %d\n", errno);
+	}
+	// Make sure we terminate child on execvp() error
+	_exit(EXIT_ERR_CMD);
+}
+
+
+/**
+ * @brief Zygote process main loop.
+ *
+ * The zygote is a fresh image of yash, run with ZYGOTE_ARG, so it has none of
+ * the memory of the shell and its page tables are small. It serves requests to spawn job
+ * stages until the shell closes the socket.
+ *
+ * Stages are created with clone(CLONE_VM|CLONE_VFORK), which copies no page
+ * tables, and CLONE_PARENT, so they are children of the shell and not of the
+ * zygote. That way the shell reaps them and gets their SIGCHLD as with forked
+ * ones. The zygote waits for each stage to call exec() before it goes on.
+ *
+ * @param	sock	Socket to the shell
+ *
+ * @sa ZygoteReq, spawnZygote()
+ */
+void runZygote(int sock) {
+	static struct ZygoteReq req;
+	char cbuf[CMSG_SPACE(sizeof(int) * ZYGOTE_FDS)];
+	int fds[ZYGOTE_FDS];
+	struct ZygoteStage stage = { &req, fds, sock, NULL };
+
+	// Die with the shell
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	char* stack = mmap(NULL, ZYGOTE_STACK_LEN, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED) {
+		_exit(EXIT_ERR);
+	}
+
+	for (;;) {
+		struct iovec iov = { &req, sizeof(req) };
+		struct msghdr msg = { 0 };
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (n <= 0) {	// Shell closed the socket
+			_exit(EXIT_OK);
+		}
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+				cmsg->cmsg_len != CMSG_LEN(sizeof(int) * ZYGOTE_FDS)) {
+			pid_t err_pid = SYSCALL_RETURN_ERR;
+			send(sock, &err_pid, sizeof(err_pid), MSG_NOSIGNAL);
+			continue;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		// Spawn the stage as a child of the shell, and wait for its exec()
+		stage.args = NULL;
+		pid_t pid = clone(runZygoteStage, stack + ZYGOTE_STACK_LEN,
+				CLONE_VM|CLONE_VFORK|CLONE_PARENT|SIGCHLD, &stage);
+		free(stage.args);	// Expanded braces, if any
+
+		for (int i=0; i<ZYGOTE_FDS; i++) {
+			close(fds[i]);
+		}
+		send(sock, &pid, sizeof(pid), MSG_NOSIGNAL);
+	}
+}
+
+
+/**
+ * @brief Start the zygote process, if not running yet.
+ *
+ * @return	True if the zygote is running, false on error (errno is set)
+ *
+ * @sa runZygote()
+ */
+bool startZygote() {
+	int sv[2];
+
+	if (zygote_fd != NO_FD) {
+		return true;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) == SYSCALL_RETURN_ERR) {
+		return false;
+	}
+
+	flushOutput();
+	pid_t pid = fork();
+	if (pid == SYSCALL_RETURN_ERR) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	} else if (pid == 0) {	// Zygote process, as a fresh image of yash
+		char fd_str[MAX_ERROR_LEN];
+		close(sv[0]);
+		fcntl(sv[1], F_SETFD, 0);
+		snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+		execl(SELF_EXE, SELF_EXE, ZYGOTE_ARG, fd_str, verbose ? "-v" : NULL,
+				(char*)NULL);
+		_exit(EXIT_ERR);
+	}
+
+	// Parent process
+	close(sv[1]);
+	zygote_fd = sv[0];
+	zygote_pid = pid;
+	if (verbose) {
+		printf("-yash: zygote process %d started\n", pid);
+	}
+	return true;
+}
+
+
+/**
+ * @brief Stop the zygote process, if running.
+ */
+void stopZygote() {
+	if (zygote_fd == NO_FD) {
+		return;
+	}
+
+	// The zygote exits when the socket is closed
+	close(zygote_fd);
+	zygote_fd = NO_FD;
+	waitpid(zygote_pid, NULL, 0);
+}
+
+
+/**
+ * @brief Spawn a job stage from the zygote process.
+ *
+ * The stage gets `fds` as stdin, stdout and stderr before doing its file
+ * redirections.
+ *
+ * @param	cmd		Command with the stage
+ * @param	stage	Stage to spawn (1 or 2)
+ * @param	pgid	Process group to join, or 0 to start a new one
+ * @param	fds		Descriptors to use as stdin, stdout and stderr
+ * @return	PID of the stage, or SYSCALL_RETURN_ERR on error
+ *
+ * @sa runZygote()
+ */
+pid_t spawnZygote(struct Job* cmd, uint8_t stage, pid_t pgid, int fds[]) {
+	static struct ZygoteReq req;
+	char cbuf[CMSG_SPACE(sizeof(int) * ZYGOTE_FDS)];
+	char** cmd_argv = stage == 1 ? cmd->cmd1 : cmd->cmd2;
+	pid_t pid;
+
+	// Build the request
+	req.pgid = pgid;
+	req.stage = stage;
+	req.sched = cmd->sched;
+	strcpy(req.in, stage == 1 ? cmd->in1 : cmd->in2);
+	strcpy(req.out, stage == 1 ? cmd->out1 : cmd->out2);
+	strcpy(req.err, stage == 1 ? cmd->err1 : cmd->err2);
+	if ((stage == 1 ? cmd->here1_fd : cmd->here2_fd) != NO_FD) {
+		strcpy(req.in, EMPTY_STR);	// The here-document is sent as stdin
+	}
+
+	size_t len = 0;
+	for (req.argc=0; cmd_argv[req.argc]; req.argc++) {
+		size_t arg_len = strlen(cmd_argv[req.argc]) + 1;
+		if (len + arg_len > sizeof(req.argv)) {
+			return SYSCALL_RETURN_ERR;
+		}
+		memcpy(&req.argv[len], cmd_argv[req.argc], arg_len);
+		len += arg_len;
+	}
+
+	// Send the request with the descriptors
+	struct iovec iov = { &req, offsetof(struct ZygoteReq, argv) + len };
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * ZYGOTE_FDS);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * ZYGOTE_FDS);
+
+	if (sendmsg(zygote_fd, &msg, MSG_NOSIGNAL) == SYSCALL_RETURN_ERR ||
+			recv(zygote_fd, &pid, sizeof(pid), 0) != sizeof(pid)) {
+		// The zygote is gone: fork from now on
+		if (verbose) {
+			printf("-yash: zygote error: errno %d\n", errno);
+		}
+		stopZygote();
+		shell_opts[OPT_ZYGOTE].value = false;
+		return SYSCALL_RETURN_ERR;
+	}
+
+	return pid;
+}
+
+
+/**
+ * @brief Arm the deadline timer for the earliest job deadline.
+ *
+ * The timer is disarmed if no job has a deadline.
+ */
+void armTimer() {
+	struct itimerspec its = { { 0 } };
+
+	if (timer_len > 0) {
+		uint64_t deadline_ns = job_arr[timer_heap[0]].deadline_ns;
+		its.it_value.tv_sec = deadline_ns / NSEC_PER_SEC;
+		its.it_value.tv_nsec = deadline_ns % NSEC_PER_SEC;
+		if (!deadline_ns) {	// A zero value disarms the timer
+			its.it_value.tv_nsec = 1;
+		}
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+
+/**
+ * @brief Swap two jobs in the timer heap.
+ *
+ * @param	a	Heap position of the first job
+ * @param	b	Heap position of the second job
+ */
+void swapTimers(int a, int b) {
+	int job_idx = timer_heap[a];
+	timer_heap[a] = timer_heap[b];
+	timer_heap[b] = job_idx;
+	job_arr[timer_heap[a]].timer_idx = a;
+	job_arr[timer_heap[b]].timer_idx = b;
+}
+
+
+/**
+ * @brief Move a job to its place in the timer heap.
+ *
+ * It is moved up while its deadline is earlier than the one of its parent,
+ * and down while it is later than the one of any of its children.
+ *
+ * @param	heap_idx	Heap position of the job
+ */
+void siftTimer(int heap_idx) {
+	while (heap_idx > 0 && job_arr[timer_heap[heap_idx]].deadline_ns <
+			job_arr[timer_heap[(heap_idx-1)/2]].deadline_ns) {
+		swapTimers(heap_idx, (heap_idx-1)/2);
+		heap_idx = (heap_idx-1)/2;
+	}
+
+	while (true) {
+		int min = heap_idx;
+		for (int child=2*heap_idx+1; child<=2*heap_idx+2; child++) {
+			if (child < timer_len && job_arr[timer_heap[child]].deadline_ns <
+					job_arr[timer_heap[min]].deadline_ns) {
+				min = child;
+			}
+		}
+		if (min == heap_idx) {
+			return;
+		}
+		swapTimers(heap_idx, min);
+		heap_idx = min;
+	}
+}
+
+
+/**
+ * @brief Set the deadline of a job.
+ *
+ * Jobs with a deadline are kept in a min-heap ordered by deadline, so a single
+ * timerfd armed for the earliest one serves all of them, and each deadline
+ * costs O(log n) to set, clear or expire. @sa handleTimer()
+ *
+ * @param	job_idx		Job index in job_arr
+ * @param	deadline_ns	Deadline (CLOCK_MONOTONIC)
+ */
+void setJobDeadline(int job_idx, uint64_t deadline_ns) {
+	struct Job* cmd = &job_arr[job_idx];
+
+	cmd->deadline_ns = deadline_ns;
+	if (cmd->timer_idx == EMPTY_ARRAY) {
+		cmd->timer_idx = timer_len;
+		timer_heap[timer_len++] = job_idx;
+	}
+	siftTimer(cmd->timer_idx);
+	armTimer();
+}
+
+
+/**
+ * @brief Clear the deadline of a job, if it has one.
+ *
+ * @param	job_idx		Job index in job_arr
+ */
+void clearJobDeadline(int job_idx) {
+	int heap_idx = job_arr[job_idx].timer_idx;
+	if (heap_idx == EMPTY_ARRAY) {
+		return;
+	}
+
+	// Fill the hole with the last job of the heap
+	job_arr[job_idx].timer_idx = EMPTY_ARRAY;
+	timer_len--;
+	if (heap_idx != timer_len) {
+		timer_heap[heap_idx] = timer_heap[timer_len];
+		job_arr[timer_heap[heap_idx]].timer_idx = heap_idx;
+		siftTimer(heap_idx);
+	}
+	armTimer();
+}
+
+
+/**
+ * @brief Signal a job that reached its deadline.
+ *
+ * The job is sent SIGTERM (and SIGCONT, in case it is stopped) first, and a
+ * new deadline is set to send it SIGKILL if it is still running by then.
+ *
+ * @param	job_idx		Job index in job_arr
+ */
+void expireJob(int job_idx) {
+	struct Job* cmd = &job_arr[job_idx];
+
+	if (!cmd->timed_out) {
+		if (verbose) {
+			printf("-yash: job %d timed out: sending SIGTERM\n", cmd->jobno);
+		}
+		cmd->timed_out = true;
+		signalJob(cmd, SIGTERM);
+		signalJob(cmd, SIGCONT);
+		setJobDeadline(job_idx, nowNs() + cmd->kill_after_ns);
+	} else {
+		if (verbose) {
+			printf("-yash: job %d timed out: sending SIGKILL\n", cmd->jobno);
+		}
+		signalJob(cmd, SIGKILL);
+	}
+}
+
+
+/**
+ * @brief Track a new process of a job.
+ *
+ * It must be called by the parent before the process is reaped.
+ *
+ * @param	cmd		Job of the process
+ * @param	pid		PID of the process
+ */
+void addJobProc(struct Job* cmd, pid_t pid) {
+	if (pid <= 0 || cmd->proc_len >= MAX_JOB_PROCS) {
+		return;
+	}
+
+	struct JobProc* proc = &cmd->procs[cmd->proc_len++];
+	proc->pid = pid;
+	proc->reaped = false;
+	proc->status = 0;
+	proc->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (proc->pidfd == SYSCALL_RETURN_ERR) {
+		proc->pidfd = NO_FD;
+	}
+}
+
+
+/**
+ * @brief Send a signal to a job through the pidfds of its processes.
+ *
+ * The whole process group is signaled through the pidfd of its leader, so the
+ * processes started by the stages get the signal as well. As the pidfd pins
+ * the leader PID, the signal cannot reach a recycled group. On kernels without
+ * process group pidfd signals, every process of the job is signaled on its
+ * own.
+ *
+ * @param	cmd		Job to signal
+ * @param	sig		Signal to send
+ * @return	True if any process was signaled
+ */
+bool signalJob(struct Job* cmd, int sig) {
+	if (cmd->proc_len > 0 && cmd->procs[0].pidfd != NO_FD &&
+			syscall(SYS_pidfd_send_signal, cmd->procs[0].pidfd, sig, NULL,
+					PIDFD_SIGNAL_PROCESS_GROUP) != SYSCALL_RETURN_ERR) {
+		return true;
+	}
+
+	bool sent = false;
+	for (int i=0; i<cmd->proc_len; i++) {
+		if (cmd->procs[i].pidfd != NO_FD &&
+				syscall(SYS_pidfd_send_signal, cmd->procs[i].pidfd, sig, NULL, 0)
+						!= SYSCALL_RETURN_ERR) {
+			sent = true;
+		}
+	}
+	return sent;
+}
+
+
+/**
+ * @brief Event handler for the deadline timer.
+ *
+ * @param	fd		Timer descriptor
+ * @param	events	Ready events
+ * @param	data	Unused
+ */
+void handleTimer(int fd, uint32_t events, void* data) {
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) == SYSCALL_RETURN_ERR) {
+		return;
+	}
+
+	uint64_t now_ns = nowNs();
+	while (timer_len > 0 && job_arr[timer_heap[0]].deadline_ns <= now_ns) {
+		int job_idx = timer_heap[0];
+		clearJobDeadline(job_idx);
+		expireJob(job_idx);
+	}
+}
+
+
+/**
+ * @brief Get the exit status of a process, as shown by shells.
+ *
+ * @param	status	Status returned by waitpid()
+ * @return	Exit code, or EXIT_SIGNAL plus the signal that killed the process
+ */
+int exitStatus(int status) {
+	if (WIFEXITED(status)) {
+		return (WEXITSTATUS(status));
+	}
+	return (EXIT_SIGNAL + WTERMSIG(status));
+}
+
+
+/**
+ * @brief Account for a job process that exited.
+ *
+ * The exit status of the last stage of the job is saved as the job status,
+ * and the PID of the process is forgotten, as it can be reused now.
+ *
+ * @param	cmd		Job of the process
+ * @param	pid		PID of the process
+ * @param	status	Status returned by waitpid()
+ */
+void reapProcess(struct Job* cmd, pid_t pid, int status) {
+	cmd->child_count--;
+
+	if (pid == cmd->pids[cmd->pipe ? 1 : 0]) {
+		cmd->exit_status = cmd->timed_out ? EXIT_TIMEOUT : exitStatus(status);
+	}
+
+	for (int i=0; i<cmd->proc_len; i++) {
+		if (cmd->procs[i].pid == pid) {
+			cmd->procs[i].reaped = true;
+			cmd->procs[i].status = exitStatus(status);
+		}
+	}
+
+	for (int i=0; i<CHILD_COUNT_PIPE; i++) {
+		if (cmd->pids[i] == pid) {
+			cmd->pids[i] = 0;
+		}
+	}
+
+	// Nothing left to signal on timeout
+	if (cmd->child_count == 0) {
+		clearJobDeadline(cmd - job_arr);
+	}
+}
+
+
+/**
+ * @brief Set up signal handling to relay signals to children processes.
+ *
+ * This function is based on the UT Austin EE 382V Systems Programming class
+ * examples posted by Dr. Ramesh Yerraballi.
+ *
+ * TODO: Add support for job control.
+ *
+ * @param cmd	Parsed command
+ */
+void waitForChildren(struct Job* cmd) {
+	const char SIG_ERR_1[MAX_ERROR_LEN] = "signal errno ";
+	const char SIG_ERR_2[MAX_ERROR_LEN] = ": waitpid error";
+	extern errno;
+	char errno_str[sizeof(int)*8+1];
+
+	int status;
+	pid_t pid;
+
+	/*
+	 * Run the event loop while no child changed state, so the output of
+	 * background jobs is drained meanwhile. It wakes up on SIGCHLD. To grow
+	 * the pipe while waiting, sample the pipe every sampling period as well.
+	 */
+	bool tune = cmd->pipe && (cmd->pipe_auto || shell_opts[OPT_PIPEAUTO].value);
+	uint64_t sampled_ns = nowNs();
+
+	// Wait for all the processes in the job process group to exit
+	while (cmd->child_count > 0) {
+		/**
+		 * TODO: Fix EINTR (4) error
+		 *
+		 * This snippet always throws the EINTR (4) error code. The
+		 * documentation for waitpid (3) says EINTR means: "WNOHANG was not set
+		 * and an unblocked signal or a SIGCHLD was caught; see signal(7)."
+		 *
+		 * TODO: Fix WCONTINUED compilation error
+		 *
+		 * See this for error description: https://stackoverflow.com/questions/
+		 * 60101242/compiler-error-using-wcontinued-option-for-waitpid
+		 */
+		//if (waitpid(-1, &status, WUNTRACED|WCONTINUED) == SYSCALL_RETURN_ERR) {
+		pid = waitpid(-cmd->gpid, &status, WUNTRACED|WNOHANG);
+		if (pid == SYSCALL_RETURN_ERR) {
+			sprintf(errno_str, "%d", errno);
+			strcpy(cmd->err_msg, SIG_ERR_1);
+			strcat(cmd->err_msg, errno_str);
+			strcat(cmd->err_msg, SIG_ERR_2);
+			break;
+		}
+
+		if (pid == 0) {	// No child changed state yet
+			runEvents(tune ? PIPE_SAMPLE_NSEC / NSEC_PER_MSEC : -1);
+			if (tune && nowNs() - sampled_ns >= PIPE_SAMPLE_NSEC) {
+				tunePipe(cmd);
+				sampled_ns = nowNs();
+			}
+		} else if (WIFEXITED(status)) {
+			if (verbose) {
+				printf("-yash: child process terminated normally\n");
+			}
+			reapProcess(cmd, pid, status);
+		} else if (WIFSIGNALED(status)) {
+			printf("\n");	// Ensure there is an space after "^C"
+			if (verbose) {
+				printf("-yash: child process terminated by a signal\n");
+			}
+			reapProcess(cmd, pid, status);
+		} else if (WIFSTOPPED(status)) {
+			printf("\n");	// Ensure there is an space after "^Z"
+			if (verbose) {
+				printf("-yash: child process stopped by a signal\n");
+			}
+
+			// Stop waiting, the job stays in the jobs table
+			strcpy(cmd->status, JOB_STATUS_STOPPED);
+			break;
+		} /*else if (WIFCONTINUED(status)) {
+			//
+		}*/
+	}
+
+}
+
+
+/**
+ * @brief Execute commands.
+ *
+ * This function allows for both simple and piped commands (1 pipe only).
+ * Moreover, the command is checked for correctness, and ignored if it does not
+ * exist.
+ *
+ * This function is based on the UT Austin EE 382V Systems Programming class
+ * examples by Dr. Ramesh Yerraballi.
+ *
+ * TODO: Add support for job control.
+ *
+ * @param	job_arr	Jobs list of parsed commands
+ * @param	last_job	Last job added to the job_arr
+ */
+void runJob(struct Job job_arr[], int* last_job) {
+	const char PIPE_ERR_1[MAX_ERROR_LEN] = "pipe errno ";
+	const char PIPE_ERR_2[MAX_ERROR_LEN] = ": failed to make pipe";
+	extern errno;
+	char errno_str[sizeof(int)*8+1];
+
+	pid_t c1_pid, c2_pid;
+	int pfd[2];
+	int mfd[2] = { NO_FD, NO_FD };	// Metered pipe to the right stage
+	int stdout_fd = NO_FD;
+	int psub_peer[MAX_PROC_SUBS];
+
+	// Choose the CPU of each stage, if spreading them
+	placeJob(&job_arr[*last_job]);
+
+	// Create the process substitution pipes first, so the /dev/fd paths are set
+	if (!openProcSubs(&job_arr[*last_job], psub_peer)) {
+		closeHereDocs(&job_arr[*last_job], 0);
+		return;
+	}
+
+	if (job_arr[*last_job].pipe) {
+		stdout_fd = dup(STDOUT_FILENO);	// Save stdout
+
+		if (pipe(pfd) == SYSCALL_RETURN_ERR) {
+			sprintf(errno_str, "%d", errno);
+			strcpy(job_arr[*last_job].err_msg, PIPE_ERR_1);
+			strcat(job_arr[*last_job].err_msg, errno_str);
+			strcat(job_arr[*last_job].err_msg, PIPE_ERR_2);
+			closeProcSubs(&job_arr[*last_job], psub_peer, 0);
+			closeHereDocs(&job_arr[*last_job], 0);
+			return;
+		}
+
+		// Set the pipe buffer size of the job, or the default one
+		int pipe_size = job_arr[*last_job].pipe_size;
+		if (pipe_size <= 0) {
+			pipe_size = shell_opts[OPT_PIPESIZE].value;
+		}
+		if (pipe_size > 0) {
+			setPipeSize(pfd[1], pipe_size);
+		}
+
+		// Save the pipe inode to find it later
+		struct stat pipe_stat;
+		if (fstat(pfd[0], &pipe_stat) != SYSCALL_RETURN_ERR) {
+			job_arr[*last_job].pipe_ino = pipe_stat.st_ino;
+		}
+
+		/*
+		 * Split a metered pipe in two, to be relayed by a helper. The new pipe
+		 * is close-on-exec, so only the right stage keeps its read end. The
+		 * statistics are shared with the helper through an anonymous mapping.
+		 */
+		if (shell_opts[OPT_PIPEMETER].value) {
+			struct PipeMeter* meter = mmap(NULL, sizeof(struct PipeMeter),
+					PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+			if (meter == MAP_FAILED || pipe2(mfd, O_CLOEXEC) == SYSCALL_RETURN_ERR) {
+				printf("-yash: could not meter pipe: errno %d\n", errno);
+				if (meter != MAP_FAILED) {
+					munmap(meter, sizeof(struct PipeMeter));
+				}
+			} else {
+				job_arr[*last_job].meter = meter;
+				setPipeSize(mfd[1], fcntl(pfd[1], F_GETPIPE_SZ));
+			}
+		}
+	}
+
+	/*
+	 * Spawn the stages from the zygote if enabled. Process substitutions need
+	 * their descriptors at the same numbers as in the shell, so those jobs are
+	 * always forked.
+	 */
+	bool use_zygote = shell_opts[OPT_ZYGOTE].value &&
+			job_arr[*last_job].psub_len == 0 && startZygote();
+
+	// Leave no batched output for the stages to inherit
+	flushOutput();
+	c1_pid = SYSCALL_RETURN_ERR;
+	if (use_zygote) {
+		int c1_fds[ZYGOTE_FDS] = {
+				job_arr[*last_job].here1_fd != NO_FD ?
+						job_arr[*last_job].here1_fd : STDIN_FILENO,
+				job_arr[*last_job].pipe ? pfd[1] : STDOUT_FILENO,
+				STDERR_FILENO
+		};
+		c1_pid = spawnZygote(&job_arr[*last_job], 1, 0, c1_fds);
+	}
+	if (c1_pid == SYSCALL_RETURN_ERR) {
+		c1_pid = fork();
+	}
+
+	if (c1_pid == 0) {	// Child 1 or left child process
+		// Create a new session and a new group, and become group leader
+		setpgid(0, 0);
+
+		// Set up signal handling sent to the children process group
+		if (verbose) {
+			printf("-yash: children process group: ignoring signal SIGTTOU, "
+					"but getting all the others\n");
+		}
+		resetChildSignals();
+
+		if (!applySched(&job_arr[*last_job], 1)) {
+			printf("-yash: %s\n", job_arr[*last_job].err_msg);
+			exit(EXIT_ERR_CMD);
+		}
+
+		// Keep only the process substitutions of this stage
+		closeProcSubs(&job_arr[*last_job], psub_peer, 1);
+		closeHereDocs(&job_arr[*last_job], 1);
+
+		if (job_arr[*last_job].pipe) {
+			close(pfd[0]);	// Close unused read end
+			dup2(pfd[1], STDOUT_FILENO);	// Make output go to pipe
+		}
+		// Do additional redirection if necessary
+		redirectSimple(&job_arr[*last_job]);
+		if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
+			if (job_arr[*last_job].pipe) {
+				dup2(stdout_fd, STDOUT_FILENO);	// Allow to write to stdout
+			}
+			printf("-yash: %s\n", job_arr[*last_job].err_msg);
+			exit(EXIT_ERR_CMD);
+		}
+
+		// Execute command
+		flushOutput();
+		char** argv = expandArgs(job_arr[*last_job].cmd1);
+		if (argv && execvp(argv[0], argv) == SYSCALL_RETURN_ERR && verbose) {
+			printf("-yash: execvp() errno: %d\n", errno);
+		}
+		// Make sure we terminate child on execvp() error
+		exit(EXIT_ERR_CMD);
+	} else {	// Parent process
+		// Save job gpid
+		setpgid(c1_pid, c1_pid);
+		job_arr[*last_job].gpid = c1_pid;
+		job_arr[*last_job].pids[0] = c1_pid;
+		job_arr[*last_job].child_count = CHILD_COUNT_SIMPLE;
+		addJobProc(&job_arr[*last_job], c1_pid);
+
+		if (job_arr[*last_job].pipe) {
+			flushOutput();
+			c2_pid = SYSCALL_RETURN_ERR;
+			if (use_zygote) {
+				int c2_fds[ZYGOTE_FDS] = {
+						job_arr[*last_job].here2_fd != NO_FD ?
+								job_arr[*last_job].here2_fd :
+								mfd[0] != NO_FD ? mfd[0] : pfd[0],
+						STDOUT_FILENO,
+						STDERR_FILENO
+				};
+				c2_pid = spawnZygote(&job_arr[*last_job], 2, c1_pid, c2_fds);
+			}
+			if (c2_pid == SYSCALL_RETURN_ERR) {
+				c2_pid = fork();
+			}
+
+			if (c2_pid == 0) {	// Child 2 or right child process
+				// Join the group created by child 1
+				setpgid(0, c1_pid);
+
+				// Set up signal handling sent to the children process group
+				if (verbose) {
+					printf("-yash: children process group: ignoring signal SIGTTOU, "
+							"but getting all the others\n");
+				}
+				resetChildSignals();
+
+				if (!applySched(&job_arr[*last_job], 2)) {
+					printf("-yash: %s\n", job_arr[*last_job].err_msg);
+					exit(EXIT_ERR_CMD);
+				}
+
+				// Keep only the process substitutions of this stage
+				closeProcSubs(&job_arr[*last_job], psub_peer, 2);
+				closeHereDocs(&job_arr[*last_job], 2);
+
+				close(pfd[1]);	// Close unused write end
+				if (mfd[0] != NO_FD) {	// Get input from the metered pipe
+					close(pfd[0]);
+					pfd[0] = mfd[0];
+				}
+				dup2(pfd[0], STDIN_FILENO);	// Get input from pipe
+
+				// Do additional redirection if necessary
+				redirectPipe(&job_arr[*last_job]);
+				if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
+					dup2(stdout_fd, STDOUT_FILENO);	// Allow to write to stdout
+					printf("-yash: %s\n", job_arr[*last_job].err_msg);
+					exit(EXIT_ERR_CMD);
+				}
+
+				// Execute command
+				flushOutput();
+				char** argv = expandArgs(job_arr[*last_job].cmd2);
+				if (argv && execvp(argv[0], argv) == SYSCALL_RETURN_ERR && verbose) {
+					printf("-yash: execvp() errno: %d\n", errno);
+				}
+				// Make sure we terminate child on execvp() error
+				exit(EXIT_ERR_CMD);
+			}
+			// Parent process
+			setpgid(c2_pid, c1_pid);
+			job_arr[*last_job].pids[1] = c2_pid;
+			job_arr[*last_job].child_count = CHILD_COUNT_PIPE;
+			addJobProc(&job_arr[*last_job], c2_pid);
+		}
+
+		// Start the process substitutions in the job process group
+		runProcSubs(&job_arr[*last_job], psub_peer, pfd);
+
+		// Start relaying a metered pipe
+		if (mfd[0] != NO_FD) {
+			runPipeMeter(&job_arr[*last_job], pfd, mfd, psub_peer);
+			close(mfd[0]);
+			close(mfd[1]);
+		}
+
+		// Start the job deadline
+		if (!job_arr[*last_job].timeout_ns &&
+				shell_opts[OPT_JOBTIMEOUT].value > 0) {
+			job_arr[*last_job].timeout_ns =
+					shell_opts[OPT_JOBTIMEOUT].value * NSEC_PER_SEC;
+		}
+		if (job_arr[*last_job].timeout_ns) {
+			setJobDeadline(*last_job, nowNs() + job_arr[*last_job].timeout_ns);
+		}
+
+		// Close pipes so EOF can work
+		if (job_arr[*last_job].pipe) {
+			close(pfd[0]);
+			close(pfd[1]);
+			close(stdout_fd);
+		}
+		closeProcSubs(&job_arr[*last_job], psub_peer, 0);
+		closeHereDocs(&job_arr[*last_job], 0);
+
+		// Parent process
+		if (!job_arr[*last_job].bg) {
+			// Give terminal control to child
+			if (verbose) {
+				printf("-yash: "
+						"giving terminal control to child process group\n");
+			}
+			if (job_control) {
+				tcsetpgrp(0, c1_pid);
+			}
+
+			// Block while waiting for children
+			waitForChildren(&job_arr[*last_job]);
+			if (strcmp(job_arr[*last_job].err_msg, EMPTY_STR)) {
+				return;
+			}
+
+			// Keep stopped jobs in the jobs table, like background jobs
+			if (!strcmp(job_arr[*last_job].status, JOB_STATUS_STOPPED)) {
+				if (job_control) {
+					tcsetpgrp(0, getpid());
+				}
+				job_arr[*last_job].bg = true;
+				job_arr[*last_job].exit_status = EXIT_SIGNAL + SIGTSTP;
+				printJob(*last_job);
+				return;
+			}
+
+			// Show the pipe statistics of the whole job
+			if (job_arr[*last_job].meter) {
+				printPipeMeter(&job_arr[*last_job]);
+			}
+
+			// Get back terminal control to parent
+			if (verbose) {
+				printf("-yash: returning terminal control to parent process\n");
+			}
+			if (job_control) {
+				tcsetpgrp(0, getpid());
+			}
+			removeJob(*last_job);	// Remove job from jobs table
+		}
+	}
+}
+
+
+/**
+ * @brief Point the standard descriptors of the shell somewhere else.
+ *
+ * Jobs inherit the standard descriptors of the shell, so this redirects all
+ * the processes of the jobs started until restoreShell() is called, along with
+ * the messages of the shell about them.
+ *
+ * @param	in_fd		New stdin, or NO_FD to keep it
+ * @param	out_fd		New stdout and stderr
+ * @param	saved_fds	Copies of the standard descriptors to restore
+ * @return	1 on success, 0 on error
+ */
+bool redirectShell(int in_fd, int out_fd, int saved_fds[]) {
+	flushOutput();
+	for (int i=0; i<STD_FDS; i++) {
+		saved_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, STD_FDS);
+		if (saved_fds[i] == SYSCALL_RETURN_ERR) {
+			while (i--) {
+				close(saved_fds[i]);
+			}
+			return (false);
+		}
+	}
+
+	if (in_fd != NO_FD) {
+		dup2(in_fd, STDIN_FILENO);
+	}
+	dup2(out_fd, STDOUT_FILENO);
+	dup2(out_fd, STDERR_FILENO);
+	return (true);
+}
+
+
+/**
+ * @brief Restore the standard descriptors of the shell.
+ *
+ * @param	saved_fds	Copies saved by redirectShell()
+ */
+void restoreShell(int saved_fds[]) {
+	flushOutput();
+	for (int i=0; i<STD_FDS; i++) {
+		dup2(saved_fds[i], i);
+		close(saved_fds[i]);
+	}
+}
+
+
+/**
+ * @brief Hash a command line with FNV-1a.
+ *
+ * @param	line	Command line
+ * @return	Hash of the line
+ */
+uint64_t hashLine(const char* line) {
+	uint64_t hash = FNV_OFFSET;
+	for (const unsigned char* c=(const unsigned char*)line; *c; c++) {
+		hash = (hash ^ *c) * FNV_PRIME;
+	}
+	return (hash);
+}
+
+
+/**
+ * @brief Move a pointer into the command string of a job copy.
+ *
+ * @param	ptr	Pointer of the original job
+ * @param	dst	Copy of the job
+ * @param	src	Original job
+ * @return	Same offset in `dst.cmd_str` if `ptr` points into `src.cmd_str`,
+ * 			or `ptr` unchanged otherwise (NULL or a string literal)
+ */
+char* rebasePlanPtr(char* ptr, struct Job* dst, struct Job* src) {
+	if (ptr >= src->cmd_str && ptr < src->cmd_str + sizeof(src->cmd_str)) {
+		return (dst->cmd_str + (ptr - src->cmd_str));
+	}
+	return (ptr);
+}
+
+
+/**
+ * @brief Copy the parsed state of a job, which was not run yet.
+ *
+ * Only the fields filled by parseJob() are copied, instead of the whole job,
+ * and the pointers of the copy into the command string are moved into its own
+ * one. The arrays of pointers are copied up to their NULL terminator. The
+ * fields set while running the job get the state of a new job.
+ *
+ * @param	dst	Copy of the job
+ * @param	src	Parsed job, without here-documents or process substitutions
+ */
+void copyPlan(struct Job* dst, struct Job* src) {
+	char** src_ptrs[] = { src->cmd_tok, src->cmd1, src->cmd2 };
+	char** dst_ptrs[] = { dst->cmd_tok, dst->cmd1, dst->cmd2 };
+
+	// Tokens
+	memcpy(dst->cmd_str, src->cmd_str, sizeof(dst->cmd_str));
+	dst->cmd_tok_len = src->cmd_tok_len;
+	for (int i=0; i<sizeof(src_ptrs)/sizeof(src_ptrs[0]); i++) {
+		uint32_t j = 0;
+		do {
+			dst_ptrs[i][j] = rebasePlanPtr(src_ptrs[i][j], dst, src);
+		} while (src_ptrs[i][j++] && j<MAX_TOKEN_NUM);
+	}
+
+	// Redirections
+	strcpy(dst->in1, src->in1);
+	strcpy(dst->out1, src->out1);
+	strcpy(dst->err1, src->err1);
+	strcpy(dst->in2, src->in2);
+	strcpy(dst->out2, src->out2);
+	strcpy(dst->err2, src->err2);
+	dst->here1 = rebasePlanPtr(src->here1, dst, src);
+	dst->here1_type = src->here1_type;
+	dst->here1_fd = NO_FD;
+	dst->here2 = rebasePlanPtr(src->here2, dst, src);
+	dst->here2_type = src->here2_type;
+	dst->here2_fd = NO_FD;
+	dst->psub_len = 0;
+
+	// Pipe, background and scheduling prefixes
+	dst->pipe = src->pipe;
+	dst->pipe_size = src->pipe_size;
+	dst->pipe_auto = src->pipe_auto;
+	dst->bg = src->bg;
+	dst->sched = src->sched;
+	dst->timeout_ns = src->timeout_ns;
+	dst->kill_after_ns = src->kill_after_ns;
+	strcpy(dst->err_msg, src->err_msg);
+
+	// State of a new job, @sa planJob()
+	dst->pipe_ino = 0;
+	dst->pipe_full = 0;
+	dst->meter = NULL;
+	memset(&dst->meter_last, 0, sizeof(dst->meter_last));
+	dst->ring = NULL;
+	dst->deadline_ns = 0;
+	dst->timer_idx = EMPTY_ARRAY;
+	dst->timed_out = false;
+	dst->gpid = EMPTY_ARRAY;
+	memset(dst->pids, 0, sizeof(dst->pids));
+	dst->proc_len = 0;
+	dst->child_count = 0;
+	dst->exit_status = 0;
+	dst->client = EMPTY_ARRAY;
+	dst->jobno = EMPTY_ARRAY;
+	strcpy(dst->status, EMPTY_STR);
+}
+
+
+/**
+ * @brief Load the parsed job of a command line from the plan cache.
+ *
+ * @param	input	Command line
+ * @param	job		Job slot to load the plan into
+ * @return	True if the line was in the cache, false if it must be parsed
+ */
+bool loadPlan(char* input, struct Job* job) {
+	if (!shell_opts[OPT_PLANCACHE].value) {
+		return (false);
+	}
+
+	uint64_t hash = hashLine(input);
+	for (int i=0; i<PLAN_CACHE_SIZE; i++) {
+		struct Plan* plan = &plan_cache[i];
+		if (plan->used && plan->hash == hash && !strcmp(plan->line, input)) {
+			copyPlan(job, &plan->job);
+			plan->used = ++plan_tick;
+			plan_hits++;
+			return (true);
+		}
+	}
+	plan_misses++;
+	return (false);
+}
+
+
+/**
+ * @brief Save the parsed job of a command line to the plan cache.
+ *
+ * Jobs with here-documents or process substitutions are not saved, as their
+ * content and pipes are set up for each run.
+ *
+ * @param	input	Command line
+ * @param	job		Job parsed from the line, and not run yet
+ */
+void savePlan(char* input, struct Job* job) {
+	if (!shell_opts[OPT_PLANCACHE].value || strlen(input) > MAX_CMD_LEN ||
+			job->here1_type != HERE_NONE || job->here2_type != HERE_NONE ||
+			job->psub_len > 0 || strcmp(job->err_msg, EMPTY_STR)) {
+		return;
+	}
+
+	// Replace a free or the least recently used plan
+	struct Plan* plan = &plan_cache[0];
+	for (int i=1; i<PLAN_CACHE_SIZE && plan->used; i++) {
+		if (plan_cache[i].used < plan->used) {
+			plan = &plan_cache[i];
+		}
+	}
+	plan->hash = hashLine(input);
+	plan->used = ++plan_tick;
+	strcpy(plan->line, input);
+	copyPlan(&plan->job, job);
+}
+
+
+/**
+ * @brief Fill a job slot from a command line.
+ *
+ * The job is loaded from the plan cache if the line ran lately. Otherwise it
+ * is parsed, and saved to the plan cache.
+ *
+ * @param	input	Raw input of the job
+ * @param	job_idx	Job index in job_arr
+ * @return	True on success, false on a syntax error (`err_msg` is set)
+ */
+bool planJob(char* input, int job_idx) {
+	// Initial state of every new job
+	static const struct Job NEW_JOB = {
+			EMPTY_STR,		// cmd_str
+			{ EMPTY_STR },	// cmd_tok
+			0,				// cmd_tok_size
+			{ EMPTY_STR },	// cmd1
+			EMPTY_STR,		// in1
+			EMPTY_STR,		// out1
+			EMPTY_STR,		// err1
+			NULL,			// here1
+			HERE_NONE,		// here1_type
+			NO_FD,			// here1_fd
+			{ EMPTY_STR },	// cmd2
+			EMPTY_STR,		// in2
+			EMPTY_STR,		// out2
+			EMPTY_STR,		// err2
+			NULL,			// here2
+			HERE_NONE,		// here2_type
+			NO_FD,			// here2_fd
+			{ { 0 } },		// psub
+			0,				// psub_len
+			{ NULL },		// psub_argv
+			EMPTY_STR,		// psub_str
+			false,			// pipe
+			0,				// pipe_size
+			false,			// pipe_auto
+			0,				// pipe_ino
+			0,				// pipe_full
+			NULL,			// meter
+			{ 0 },			// meter_last
+			false,			// bg
+			NULL,			// ring
+			{ { { 0 } } },	// sched
+			0,				// timeout_ns
+			DEFAULT_KILL_AFTER_NSEC,	// kill_after_ns
+			0,				// deadline_ns
+			EMPTY_ARRAY,	// timer_idx
+			false,			// timed_out
+			EMPTY_ARRAY,	// gpid
+			{ 0 },			// pids
+			{ { 0 } },		// procs
+			0,				// proc_len
+			0,				// child_count
+			0,				// exit_status
+			EMPTY_ARRAY,	// client
+			EMPTY_ARRAY,	// jobno
+			EMPTY_STR,		// status
+			EMPTY_STR		// err_msg
+	};
+
+	if (loadPlan(input, &job_arr[job_idx])) {
+		if (verbose) {
+			printf("-yash: loaded parsed job from the plan cache\n");
+		}
+		return (true);
+	}
+
+	job_arr[job_idx] = NEW_JOB;
+	parseJob(input, job_arr, &job_idx);
+	if (strcmp(job_arr[job_idx].err_msg, EMPTY_STR)) {
+		return (false);
+	}
+	savePlan(input, &job_arr[job_idx]);
+	return (true);
+}
+
+
+/**
+ * @brief Handle new job.
+ *
+ * This function parses the raw input of the new job, adds the job to the jobs
+ * table, and it executes the new job.
  *
  * @param	input	Raw input of the new job
+ * @param	bg		Run the job in the background, even without `&`
+ * @return	Index of the job if it is still running, or EMPTY_ARRAY
+ */
+int handleNewJob(char* input, bool bg) {
+	// Jobs that cannot run fail as syntax errors
+	last_status = EXIT_ERR_CMD;
+
+	// Add command to the jobs array
+	int job_idx = findFreeJob();
+	if (job_idx == EMPTY_ARRAY) {
+		printf("-yash: max number of concurrent jobs reached: %d\n",
+				MAX_CONCURRENT_JOBS);
+		return (EMPTY_ARRAY);
+	}
+	if (job_idx > last_job) {
+		last_job = job_idx;
+	}
+
+	// Parse job
+	if (verbose) {
+		printf("-yash: parsing input...\n");
+	}
+	bool parsed = planJob(input, job_idx);
+	job_arr[job_idx].jobno = job_idx + 1;
+	strcpy(job_arr[job_idx].status, JOB_STATUS_RUNNING);
+	if (!parsed) {
+		printf("-yash: %s\n", job_arr[job_idx].err_msg);
+		removeJob(job_idx);	// Nothing to run
+		return (EMPTY_ARRAY);
+	}
+	if (bg) {
+		job_arr[job_idx].bg = true;
+	}
+
+	// Load here-documents before running the job
+	if (!openHereDocs(&job_arr[job_idx])) {
+		printf("-yash: %s\n", job_arr[job_idx].err_msg);
+		removeJob(job_idx);	// Nothing to run
+		return (EMPTY_ARRAY);
+	}
+
+	// Capture the output of background jobs instead of writing to the terminal
+	int cap[2] = { NO_FD, NO_FD };
+	int saved_fds[STD_FDS];
+	if (job_arr[job_idx].bg && !bg && shell_opts[OPT_BGCAPTURE].value) {
+		size_t size = shell_opts[OPT_BGBUFSIZE].value > 0 ?
+				shell_opts[OPT_BGBUFSIZE].value : RING_DEFAULT_SIZE;
+		job_arr[job_idx].ring = newRingBuf(size, shell_opts[OPT_BGSPILL].value);
+		if (!job_arr[job_idx].ring ||
+				pipe2(cap, O_CLOEXEC) == SYSCALL_RETURN_ERR ||
+				!redirectShell(NO_FD, cap[1], saved_fds)) {
+			printf("-yash: could not capture job output: errno %d\n", errno);
+			if (cap[0] != NO_FD) {
+				close(cap[0]);
+				close(cap[1]);
+			}
+			free(job_arr[job_idx].ring);
+			job_arr[job_idx].ring = NULL;
+		}
+	}
+
+	// Run job
+	if (verbose) {
+		printf("-yash: executing command...\n");
+	}
+	runJob(job_arr, &job_idx);
+
+	// Drain the captured output from the event loop
+	struct RingBuf* ring = job_arr[job_idx].ring;
+	if (ring) {
+		restoreShell(saved_fds);
+		close(cap[1]);
+		fcntl(cap[0], F_SETFL, O_NONBLOCK);
+		if (addEventSource(cap[0], EPOLLIN, drainRingBuf, ring)) {
+			ring->fd = cap[0];
+		} else {
+			close(cap[0]);
+		}
+	}
+
+	if (strcmp(job_arr[job_idx].err_msg, EMPTY_STR)) {
+		printf("-yash: %s\n", job_arr[job_idx].err_msg);
+		if (job_arr[job_idx].jobno > 0 && job_arr[job_idx].child_count == 0) {
+			removeJob(job_idx);	// Nothing left to reap
+		}
+		return (EMPTY_ARRAY);
+	}
+
+	// Foreground jobs are removed once done
+	if (job_arr[job_idx].jobno <= 0) {
+		last_status = job_arr[job_idx].exit_status;
+		return (EMPTY_ARRAY);
+	}
+	// Foreground jobs stopped by ^Z are kept as well
+	last_status = strcmp(job_arr[job_idx].status, JOB_STATUS_STOPPED) ?
+			EXIT_OK : job_arr[job_idx].exit_status;
+	return (job_idx);
+}
+
+/**
+ * @brief Collect the state changes of the processes of a job.
+ *
+ * @param	job_idx	Job index in job_arr
+ * @return	True if every process of the job was reaped
+ */
+bool reapJob(int job_idx) {
+	struct Job* cmd = &job_arr[job_idx];
+	int status;
+	pid_t pid;
+
+	// Grow the job pipe if needed
+	tunePipe(cmd);
+
+	// Collect the state changes of every process in the job group
+	while (cmd->child_count > 0 &&
+			(pid = waitpid(-cmd->gpid, &status,
+					WNOHANG|WUNTRACED|WCONTINUED)) != 0) {
+		if (pid == SYSCALL_RETURN_ERR) {
+			if (errno != ECHILD) {
+				printf("-yash: error checking child %d status: %d\n",
+						cmd->gpid, errno);
+			}
+			cmd->child_count = 0;	// Nothing left to reap
+		} else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (verbose && WIFEXITED(status)) {
+				printf("-yash: child process terminated normally\n");
+			} else if (verbose) {
+				printf("-yash: child process terminated by a signal\n");
+			}
+			reapProcess(cmd, pid, status);
+		} else if (WIFSTOPPED(status)) {
+			if (verbose) {
+				printf("-yash: child process stopped by a signal\n");
+			}
+
+			// Change status to stopped
+			strcpy(cmd->status, JOB_STATUS_STOPPED);
+		} else if (WIFCONTINUED(status)) {
+			if (verbose) {
+				printf("-yash: child process continued by a signal\n");
+			}
+
+			// Change status to running
+			strcpy(cmd->status, JOB_STATUS_RUNNING);
+		}
+	}
+
+	return (cmd->child_count == 0);
+}
+
+
+/**
+ * @brief Check if any background jobs finished.
+ *
+ * Check if any previously running job in the jobs table has finished running.
+ * The finished jobs of command server clients are reported to their client
+ * instead of being printed. @sa finishClientJob()
+ */
+void maintainJobsTable() {
+	// Check every job in the job_arr
+	for (int i=0; i<=last_job; i++) {
+		// Skip jobs that already finished
+		if ((!strcmp(job_arr[i].status, JOB_STATUS_RUNNING) ||
+				!strcmp(job_arr[i].status, JOB_STATUS_STOPPED)) && reapJob(i)) {
+			// Change status to done, and remove job from array
+			strcpy(job_arr[i].status, JOB_STATUS_DONE);
+			if (job_arr[i].client != EMPTY_ARRAY) {	// Not a job of the shell user
+				finishClientJob(i);
+			} else {
+				printJob(i);
+			}
+
+			// Keep the captured output until it is shown
+			struct RingBuf* ring = job_arr[i].ring;
+			if (!ring || (ring->fd == NO_FD && !ring->len &&
+					!ring->spilled && !ring->dropped)) {
+				removeJob(i);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Terminate all jobs in the jobs list.
+ *
+ * Jobs are sent SIGTERM first, and given up to EXIT_KILL_AFTER_MSEC to exit,
+ * while the pidfds of their processes are polled. Jobs still running after
+ * that are sent SIGKILL.
+ */
+void killAllJobs() {
+	struct pollfd pfds[MAX_CONCURRENT_JOBS * MAX_JOB_PROCS];
+	nfds_t pfds_len = 0;
+
+	// Ask every job to terminate, and watch its processes exit
+	for (int i=0; i<=last_job; i++) {
+		// Skip jobs that already finished
+		if (!strcmp(job_arr[i].status, JOB_STATUS_RUNNING) ||
+				!strcmp(job_arr[i].status, JOB_STATUS_STOPPED)) {
+			if (verbose) {
+				printf("-yash: sending SIGTERM to job %d\n", job_arr[i].jobno);
+			}
+			signalJob(&job_arr[i], SIGTERM);
+			signalJob(&job_arr[i], SIGCONT);
+			for (int j=0; j<job_arr[i].proc_len; j++) {
+				if (job_arr[i].procs[j].pidfd != NO_FD) {
+					pfds[pfds_len].fd = job_arr[i].procs[j].pidfd;
+					pfds[pfds_len].events = POLLIN;
+					pfds_len++;
+				}
+			}
+		}
+	}
+
+	// Wait for the processes to exit, dropping the ones that did
+	uint64_t deadline_ns = nowNs() + EXIT_KILL_AFTER_MSEC * NSEC_PER_MSEC;
+	while (pfds_len > 0) {
+		uint64_t now_ns = nowNs();
+		if (now_ns >= deadline_ns ||
+				poll(pfds, pfds_len, (deadline_ns - now_ns + NSEC_PER_MSEC - 1) /
+						NSEC_PER_MSEC) <= 0) {
+			break;
+		}
+		for (nfds_t k=0; k<pfds_len; ) {
+			if (pfds[k].revents) {
+				pfds[k] = pfds[--pfds_len];
+			} else {
+				k++;
+			}
+		}
+	}
+
+	// Kill the jobs that are still running
+	for (int i=0; i<=last_job; i++) {
+		for (nfds_t k=0; k<pfds_len; k++) {
+			bool found = false;
+			for (int j=0; j<job_arr[i].proc_len; j++) {
+				found = found || job_arr[i].procs[j].pidfd == pfds[k].fd;
+			}
+			if (found) {
+				if (verbose) {
+					printf("-yash: sending SIGKILL to job %d\n", job_arr[i].jobno);
+				}
+				signalJob(&job_arr[i], SIGKILL);
+				break;
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief Create the event loop.
+ *
+ * The event loop watches descriptors with epoll(7), and calls the handler of
+ * each descriptor when it is ready. @sa runEvents()
+ *
+ * SIGCHLD is blocked, and read from a signalfd watched by the loop, so the
+ * loop wakes up when a child changes state. Job processes unblock it before
+ * exec(). @sa resetChildSignals()
+ *
+ * Job deadlines are served by a timerfd watched by the loop as well.
+ * @sa setJobDeadline()
+ *
+ * @return	1 on success, 0 on error
+ */
+bool initEvents() {
+	sigset_t mask;
+
+	if (epoll_fd != NO_FD) {
+		return (true);
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == SYSCALL_RETURN_ERR) {
+		epoll_fd = NO_FD;
+		return (false);
+	}
+	for (int i=0; i<MAX_EVENT_SOURCES; i++) {
+		event_srcs[i].fd = NO_FD;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	signal_fd = signalfd(NO_FD, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	return (signal_fd != SYSCALL_RETURN_ERR &&
+			timer_fd != SYSCALL_RETURN_ERR &&
+			addEventSource(signal_fd, EPOLLIN, handleSignals, NULL) &&
+			addEventSource(timer_fd, EPOLLIN, handleTimer, NULL));
+}
+
+
+/**
+ * @brief Add a descriptor to the event loop.
+ *
+ * The descriptor is level-triggered, so the handler is called again until it
+ * consumes the ready data, or it pauses the descriptor.
+ *
+ * @param	fd		Descriptor to watch
+ * @param	events	Events to watch (0 to add it paused)
+ * @param	handler	Function called when the descriptor is ready
+ * @param	data	Data passed to the handler
+ * @return	1 on success, 0 on error
+ */
+bool addEventSource(int fd, uint32_t events, EventHandler handler, void* data) {
+	for (int i=0; i<MAX_EVENT_SOURCES; i++) {
+		if (event_srcs[i].fd == NO_FD) {
+			/*
+			 * Save the slot and the descriptor in the event, so events of a
+			 * source removed in the same loop iteration can be told apart.
+			 */
+			struct epoll_event ev = { 0 };
+			ev.events = events;
+			ev.data.u64 = ((uint64_t) i << 32) | (uint32_t) fd;
+			if (events &&
+					epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == SYSCALL_RETURN_ERR) {
+				return (false);
+			}
+
+			event_srcs[i].fd = fd;
+			event_srcs[i].events = events;
+			event_srcs[i].handler = handler;
+			event_srcs[i].data = data;
+			return (true);
+		}
+	}
+
+	errno = ENOSPC;
+	return (false);
+}
+
+
+/**
+ * @brief Change the events watched on a descriptor of the event loop.
+ *
+ * @param	fd		Watched descriptor
+ * @param	events	Events to watch (0 to pause it)
+ * @return	1 on success, 0 on error
+ */
+bool setEventSource(int fd, uint32_t events) {
+	for (int i=0; i<MAX_EVENT_SOURCES; i++) {
+		if (event_srcs[i].fd == fd) {
+			if (event_srcs[i].events == events) {
+				return (true);
+			}
+
+			struct epoll_event ev = { 0 };
+			int op = EPOLL_CTL_MOD;
+			ev.events = events;
+			ev.data.u64 = ((uint64_t) i << 32) | (uint32_t) fd;
+			if (!events) {
+				op = EPOLL_CTL_DEL;
+			} else if (!event_srcs[i].events) {
+				op = EPOLL_CTL_ADD;
+			}
+			if (epoll_ctl(epoll_fd, op, fd, &ev) == SYSCALL_RETURN_ERR) {
+				return (false);
+			}
+
+			event_srcs[i].events = events;
+			return (true);
+		}
+	}
+
+	errno = ENOENT;
+	return (false);
+}
+
+
+/**
+ * @brief Remove a descriptor from the event loop.
+ *
+ * It must be called before closing the descriptor.
+ *
+ * @param	fd		Watched descriptor
+ */
+void removeEventSource(int fd) {
+	for (int i=0; i<MAX_EVENT_SOURCES; i++) {
+		if (event_srcs[i].fd == fd) {
+			if (event_srcs[i].events) {
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			}
+			event_srcs[i].fd = NO_FD;
+			event_srcs[i].events = 0;
+			return;
+		}
+	}
+}
+
+
+/**
+ * @brief Run one iteration of the event loop.
+ *
+ * Wait for any watched descriptor to be ready, and call the handlers of the
+ * ready ones.
+ *
+ * @param	timeout_ms	Max time to wait in milliseconds (-1 to wait forever)
+ * @return	1 on success or timeout, 0 on error
+ */
+bool runEvents(int timeout_ms) {
+	struct epoll_event evs[MAX_EVENTS];
+
+	// Write the output batched since the last wait
+	flushOutput();
+
+	int n = epoll_wait(epoll_fd, evs, MAX_EVENTS, timeout_ms);
+	if (n == SYSCALL_RETURN_ERR) {
+		return (errno == EINTR);
+	}
+
+	for (int i=0; i<n; i++) {
+		int slot = evs[i].data.u64 >> 32;
+		int fd = (int) (uint32_t) evs[i].data.u64;
+
+		// Skip sources removed or paused by a previous handler
+		if (event_srcs[slot].fd != fd || !event_srcs[slot].events) {
+			continue;
+		}
+		event_srcs[slot].handler(fd, evs[i].events, event_srcs[slot].data);
+	}
+	return (true);
+}
+
+
+/**
+ * @brief Add a reply to the output buffer of a server client.
+ *
+ * The reply is a header line with its type and value, followed by `len` bytes
+ * of `data`. @sa Client
+ *
+ * @param	client	Server client
+ * @param	type	Reply type (SERVER_REP_OUTPUT or SERVER_REP_EXIT)
+ * @param	value	Reply value (output length or exit status)
+ * @param	data	Reply data, if any
+ * @param	len		Length of the reply data
+ */
+void queueClientReply(struct Client* client, char type, long value,
+		const char* data, size_t len) {
+	if (client->out_len + SERVER_HDR_LEN + len > SERVER_BUF_LEN) {
+		printf("-yash: server: reply to client %d dropped\n", client->fd);
+		return;
+	}
+
+	client->out_len += snprintf(client->out_buf + client->out_len,
+			SERVER_HDR_LEN, "%c %ld\n", type, value);
+	if (len > 0) {
+		memcpy(client->out_buf + client->out_len, data, len);
+		client->out_len += len;
+	}
+}
+
+
+/**
+ * @brief Update the events watched for a server client.
+ *
+ * New requests are only read while the client has no command running and no
+ * replies pending, and captured output is only read while there are no
+ * replies pending. This way, a slow client blocks its own command, but not
+ * the rest of the clients.
+ *
+ * @param	client	Server client
+ */
+void updateClient(struct Client* client) {
+	bool busy = client->job_idx != EMPTY_ARRAY || client->cap_fd != NO_FD;
+	bool pending = client->out_len > client->out_pos;
+
+	if (client->fd != NO_FD) {
+		uint32_t events = 0;
+		if (!busy && !pending && !client->eof &&
+				client->in_len < sizeof(client->in_buf)) {
+			events |= EPOLLIN;
+		}
+		if (pending) {
+			events |= EPOLLOUT;
+		}
+		setEventSource(client->fd, events);
+	}
+
+	if (client->cap_fd != NO_FD) {
+		setEventSource(client->cap_fd, pending ? 0 : EPOLLIN);
+	}
+}
+
+
+/**
+ * @brief Send as many pending replies to a server client as possible.
+ *
+ * The client is closed if it is gone.
+ *
+ * @param	client	Server client
+ */
+void flushClient(struct Client* client) {
+	while (client->fd != NO_FD && client->out_pos < client->out_len) {
+		ssize_t n = send(client->fd, client->out_buf + client->out_pos,
+				client->out_len - client->out_pos, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (n == SYSCALL_RETURN_ERR) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			} else if (errno != EINTR) {
+				closeClient(client);
+			}
+		} else {
+			client->out_pos += n;
+		}
+	}
+
+	client->out_len = 0;
+	client->out_pos = 0;
+}
+
+
+/**
+ * @brief Close the descriptors of a server client.
+ *
+ * A command still running for the client is not stopped, but its captured
+ * output is closed. The client slot is released once the command is done.
+ * @sa processClient()
+ *
+ * @param	client	Server client
+ */
+void closeClient(struct Client* client) {
+	if (client->fd != NO_FD) {
+		if (verbose) {
+			printf("-yash: server: client %d disconnected\n", client->fd);
+		}
+		removeEventSource(client->fd);
+		close(client->fd);
+		client->fd = NO_FD;
+	}
+	if (client->cap_fd != NO_FD) {
+		removeEventSource(client->cap_fd);
+		close(client->cap_fd);
+		client->cap_fd = NO_FD;
+	}
+}
+
+
+/**
+ * @brief Reply with the exit status of a client command if it is done.
+ *
+ * A command is done once its job finished and all its output was captured.
+ *
+ * @param	client	Server client
+ */
+void finishClientCmd(struct Client* client) {
+	if (client->job_idx == EMPTY_ARRAY && client->cap_fd == NO_FD &&
+			client->fd != NO_FD) {
+		queueClientReply(client, SERVER_REP_EXIT, client->status, NULL, 0);
+	}
+}
+
+
+/**
+ * @brief Save the exit status of a finished client job.
+ *
+ * It is called from maintainJobsTable() before the job is removed. The next
+ * request of the client is run later by processClient(), once the job slot is
+ * free.
+ *
+ * @param	job_idx	Job index in job_arr
+ */
+void finishClientJob(int job_idx) {
+	struct Client* client = &clients[job_arr[job_idx].client];
+
+	client->status = job_arr[job_idx].exit_status;
+	client->job_idx = EMPTY_ARRAY;
+	job_arr[job_idx].client = EMPTY_ARRAY;
+	finishClientCmd(client);
+}
+
+
+/**
+ * @brief Event handler to relay the captured output of a client command.
+ *
+ * @param	fd		Read end of the capture pipe
+ * @param	events	Ready events
+ * @param	data	Server client
+ */
+void relayClientOutput(int fd, uint32_t events, void* data) {
+	static char chunk[SERVER_BUF_LEN];
+	struct Client* client = data;
+
+	// Keep the output in the pipe until the previous chunk is sent
+	if (client->out_len > 0) {
+		updateClient(client);
+		return;
+	}
+
+	ssize_t n = read(fd, chunk, SERVER_BUF_LEN - 2*SERVER_HDR_LEN);
+	if (n == SYSCALL_RETURN_ERR && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+
+	if (n > 0) {
+		queueClientReply(client, SERVER_REP_OUTPUT, n, chunk, n);
+	} else {	// All the output was captured
+		removeEventSource(fd);
+		close(fd);
+		client->cap_fd = NO_FD;
+		finishClientCmd(client);
+	}
+	processClient(client);
+}
+
+
+/**
+ * @brief Run a request of a server client.
+ *
+ * The command runs as a background job of the shell, so it shares the jobs
+ * table with the rest of the clients. Its stdin is /dev/null, and its stdout
+ * and stderr are the capture pipe or /dev/null, as are the shell messages about
+ * the command, like syntax errors. Shell commands (`jobs`, `set`, etc.) run
+ * right away.
+ *
+ * @param	client	Server client
+ * @param	line	Request line, without the new-line
+ */
+void runClientCmd(struct Client* client, char* line) {
+	int cap[2] = { NO_FD, NO_FD };
+	char* cmd = line + 1;
+
+	if (*cmd == ' ') {
+		cmd++;
+	}
+	client->status = EXIT_OK;
+	if ((line[0] != SERVER_REQ_RUN && line[0] != SERVER_REQ_CAPTURE) ||
+			strlen(cmd) > MAX_CMD_LEN) {
+		client->status = EXIT_ERR_ARG;
+		finishClientCmd(client);
+		return;
+	}
+	if (ignoreInput(cmd)) {
+		finishClientCmd(client);
+		return;
+	}
+
+	if (line[0] == SERVER_REQ_CAPTURE &&
+			pipe2(cap, O_CLOEXEC) == SYSCALL_RETURN_ERR) {
+		printf("-yash: server: capture pipe errno %d\n", errno);
+		client->status = EXIT_ERR;
+		finishClientCmd(client);
+		return;
+	}
+	if (verbose) {
+		printf("-yash: server: client %d: %s\n", client->fd, cmd);
+	}
+
+	// Jobs inherit the standard descriptors of the shell
+	int saved_fds[STD_FDS];
+	if (!redirectShell(null_fd, cap[1] != NO_FD ? cap[1] : null_fd, saved_fds)) {
+		printf("-yash: server: redirection errno %d\n", errno);
+		if (cap[1] != NO_FD) {
+			close(cap[0]);
+			close(cap[1]);
+		}
+		client->status = EXIT_ERR;
+		finishClientCmd(client);
+		return;
+	}
+
+	if (runShellCmd(cmd)) {
+		client->status = last_status;
+	} else {
+		client->job_idx = handleNewJob(cmd, true);
+		if (client->job_idx == EMPTY_ARRAY) {
+			client->status = EXIT_ERR_CMD;
+		} else {
+			job_arr[client->job_idx].client = client - clients;
+		}
+	}
+
+	restoreShell(saved_fds);
+
+	// Relay the output until every process holding the pipe exits
+	if (cap[1] != NO_FD) {
+		close(cap[1]);
+		fcntl(cap[0], F_SETFL, O_NONBLOCK);
+		if (addEventSource(cap[0], EPOLLIN, relayClientOutput, client)) {
+			client->cap_fd = cap[0];
+		} else {
+			close(cap[0]);
+		}
+	}
+	finishClientCmd(client);
+}
+
+
+/**
+ * @brief Make progress on the requests of a server client.
+ *
+ * Send the pending replies, and run the next request once the previous one
+ * is done and its replies were sent. If the jobs table is full, the request
+ * waits until a job finishes.
+ *
+ * The client slot is released once the client is gone, or it sent all its
+ * requests and got all its replies.
+ *
+ * @param	client	Server client
+ */
+void processClient(struct Client* client) {
+	char line[sizeof(client->in_buf)];
+
+	if (!client->used) {
+		return;
+	}
+	flushClient(client);
+
+	while (client->fd != NO_FD && client->out_len == 0 &&
+			client->job_idx == EMPTY_ARRAY && client->cap_fd == NO_FD) {
+		char* nl = memchr(client->in_buf, '\n', client->in_len);
+		if (!nl) {
+			if (client->in_len < sizeof(client->in_buf)) {
+				break;
+			}
+			// Drop a request too long to be a command
+			client->in_len = 0;
+			client->status = EXIT_ERR_ARG;
+			finishClientCmd(client);
+		} else if (findFreeJob() == EMPTY_ARRAY) {
+			break;
+		} else {
+			size_t len = nl - client->in_buf;
+			memcpy(line, client->in_buf, len);
+			line[len] = '\0';
+			client->in_len -= len + 1;
+			memmove(client->in_buf, nl + 1, client->in_len);
+
+			runClientCmd(client, line);
+		}
+		flushClient(client);
+	}
+
+	// Release the client slot once it has nothing left to do
+	if (client->job_idx == EMPTY_ARRAY && client->cap_fd == NO_FD &&
+			(client->fd == NO_FD || (client->eof && client->out_len == 0 &&
+					!memchr(client->in_buf, '\n', client->in_len)))) {
+		closeClient(client);
+		client->used = false;
+		return;
+	}
+	updateClient(client);
+}
+
+
+/**
+ * @brief Event handler to read the requests of a server client.
+ *
+ * @param	fd		Client socket
+ * @param	events	Ready events
+ * @param	data	Server client
+ */
+void handleClient(int fd, uint32_t events, void* data) {
+	struct Client* client = data;
+
+	if ((events & (EPOLLIN|EPOLLHUP|EPOLLERR)) &&
+			client->in_len < sizeof(client->in_buf)) {
+		ssize_t n = recv(fd, client->in_buf + client->in_len,
+				sizeof(client->in_buf) - client->in_len, MSG_DONTWAIT);
+		if (n == 0) {	// Client sent all its requests
+			client->eof = true;
+
+			// Take an unterminated last line as a request
+			if (client->in_len > 0 &&
+					client->in_len < sizeof(client->in_buf) &&
+					!memchr(client->in_buf, '\n', client->in_len)) {
+				client->in_buf[client->in_len++] = '\n';
+			}
+		} else if (n > 0) {
+			client->in_len += n;
+		} else if (errno != EAGAIN && errno != EINTR) {
+			closeClient(client);
+		}
+	} else if (events & (EPOLLHUP|EPOLLERR)) {
+		closeClient(client);
+	}
+	processClient(client);
+}
+
+
+/**
+ * @brief Event handler to accept new server clients.
+ *
+ * @param	fd		Server socket
+ * @param	events	Ready events
+ * @param	data	Unused
+ */
+void acceptClient(int fd, uint32_t events, void* data) {
+	int client_fd;
+
+	while ((client_fd = accept4(fd, NULL, NULL,
+			SOCK_NONBLOCK|SOCK_CLOEXEC)) != SYSCALL_RETURN_ERR) {
+		struct Client* client = NULL;
+		for (int i=0; i<SERVER_MAX_CLIENTS; i++) {
+			if (!clients[i].used) {
+				client = &clients[i];
+				break;
+			}
+		}
+
+		if (!client ||
+				!addEventSource(client_fd, EPOLLIN, handleClient, client)) {
+			printf("-yash: server: max number of clients reached: %d\n",
+					SERVER_MAX_CLIENTS);
+			close(client_fd);
+			continue;
+		}
+		if (verbose) {
+			printf("-yash: server: client %d connected\n", client_fd);
+		}
+
+		client->used = true;
+		client->fd = client_fd;
+		client->eof = false;
+		client->in_len = 0;
+		client->out_len = 0;
+		client->out_pos = 0;
+		client->job_idx = EMPTY_ARRAY;
+		client->cap_fd = NO_FD;
+		client->status = EXIT_OK;
+	}
+}
+
+
+/**
+ * @brief Event handler for the signals read from the signalfd.
+ *
+ * SIGCHLD only wakes up the loop in the interactive shell, as finished jobs
+ * are reported before the next prompt, and SIGINT stops waiting for jobs. In
+ * the command server, it reaps finished jobs, and lets waiting clients run
+ * their next request. Any other signal stops the server.
+ *
+ * @param	fd		Signal descriptor
+ * @param	events	Ready events
+ * @param	data	Unused
+ */
+void handleSignals(int fd, uint32_t events, void* data) {
+	struct signalfd_siginfo info;
+	bool child = false;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGCHLD) {
+			child = true;
+		} else if (server_running) {
+			server_running = false;
+		} else {	// SIGINT while waiting, @sa waitExec()
+			interrupted = true;
+		}
+	}
+
+	if (child && server_running) {
+		maintainJobsTable();
+		for (int i=0; i<SERVER_MAX_CLIENTS; i++) {
+			processClient(&clients[i]);
+		}
+	}
+}
+
+
+/**
+ * @brief Create the listening socket of the command server.
+ *
+ * A socket left by a previous server on the same path is replaced, but no
+ * other kind of file.
+ *
+ * @param	path	Path of the Unix socket
+ * @return	Socket descriptor, or SYSCALL_RETURN_ERR on error
+ */
+int openServerSocket(char* path) {
+	struct sockaddr_un addr = { 0 };
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (SYSCALL_RETURN_ERR);
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd == SYSCALL_RETURN_ERR) {
+		return (SYSCALL_RETURN_ERR);
+	}
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == SYSCALL_RETURN_ERR ||
+			listen(fd, SERVER_BACKLOG) == SYSCALL_RETURN_ERR) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return (SYSCALL_RETURN_ERR);
+	}
+	return (fd);
+}
+
+
+/**
+ * @brief Run the shell as a command server.
+ *
+ * The server accepts clients on a Unix socket, and runs the command lines they
+ * send until it gets SIGINT, SIGTERM or SIGHUP. Clients, captured output,
+ * finished jobs and signals are all handled by the event loop, so a single
+ * shell process serves all the clients concurrently. @sa Client
+ *
+ * @param	path	Path of the Unix socket
+ * @return	Errorcode
  */
-void handleNewJob(char* input) {
-	// Initialize a new Job struct
-	struct Job job = {
-			EMPTY_STR,		// cmd_str
-			{ EMPTY_STR },	// cmd_tok
-			0,				// cmd_tok_size
-			{ EMPTY_STR },	// cmd1
-			EMPTY_STR,		// in1
-			EMPTY_STR,		// out1
-			EMPTY_STR,		// err1
-			{ EMPTY_STR },	// cmd2
-			EMPTY_STR,		// in2
-			EMPTY_STR,		// out2
-			EMPTY_STR,		// err2
-			false,			// pipe
-			false,			// bg
-			EMPTY_ARRAY,	// gpid
-			EMPTY_ARRAY,	// jobno
-			EMPTY_STR,		// status
-			EMPTY_STR		// err_msg
-	};
+int runServer(char* path) {
+	sigset_t mask;
+	int listen_fd;
 
-	// Add command to the jobs array
-	if (last_job < MAX_CONCURRENT_JOBS) {
-		last_job++;
-		job_arr[last_job] = job;
-		job_arr[last_job].jobno = last_job + 1;
-		strcpy(job_arr[last_job].status, JOB_STATUS_RUNNING);
-	} else {
-		printf("-yash: max number of concurrent jobs reached: %d",
-				last_job);
-		return;
+	// Handle termination signals in the event loop as well
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	if (signalfd(signal_fd, &mask, 0) == SYSCALL_RETURN_ERR ||
+			(null_fd = open(DEV_NULL, O_RDWR|O_CLOEXEC)) == SYSCALL_RETURN_ERR) {
+		printf("-yash: could not start server: errno %d\n", errno);
+		return (EXIT_ERR);
 	}
 
-	// Parse job
+	listen_fd = openServerSocket(path);
+	if (listen_fd == SYSCALL_RETURN_ERR ||
+			!addEventSource(listen_fd, EPOLLIN, acceptClient, NULL)) {
+		printf("-yash: could not listen on %s: errno %d\n", path, errno);
+		return (EXIT_ERR_ARG);
+	}
 	if (verbose) {
-		printf("-yash: parsing input...\n");
+		printf("-yash: server listening on %s\n", path);
 	}
-	parseJob(input, job_arr, &last_job);
-	if (strcmp(job_arr[last_job].err_msg, EMPTY_STR)) {
-		printf("-yash: %s\n", job_arr[last_job].err_msg);
-		return;
+
+	server_running = true;
+	while (server_running && runEvents(-1));
+
+	if (verbose) {
+		printf("-yash: stopping server...\n");
+	}
+	for (int i=0; i<SERVER_MAX_CLIENTS; i++) {
+		if (clients[i].used) {
+			closeClient(&clients[i]);
+		}
 	}
+	killAllJobs();
+	stopZygote();
+	close(listen_fd);
+	unlink(path);
 
-	// Run job
+	return (EXIT_OK);
+}
+
+
+/**
+ * @brief Run a line of input, and check for finished jobs.
+ *
+ * @param	in_str	Input line
+ */
+void runLine(char* in_str) {
+	// Check input to ignore and show the prompt again
 	if (verbose) {
-		printf("-yash: executing command...\n");
+		printf("-yash: checking if input should be ignored...\n");
 	}
-	runJob(job_arr, &last_job);
-	if (last_job != EMPTY_ARRAY) {
-		if (strcmp(job_arr[last_job].err_msg, EMPTY_STR)) {
-			printf("-yash: %s\n", job_arr[last_job].err_msg);
-			return;
+
+	// Check if input should be ignored
+	if (ignoreInput(in_str)) {
+		if (verbose) {
+			printf("-yash: input ignored\n");
+		}
+	} else if (strlen(in_str) > MAX_CMD_LEN) {
+		printf("-yash: command too long: max %d characters\n", MAX_CMD_LEN);
+		last_status = EXIT_ERR_ARG;
+	} else if (runShellCmd(in_str)) {	// Check if input is a shell command
+		if (verbose) {
+			printf("-yash: ran shell command\n");
+		}
+	} else {	// Handle new job
+		if (verbose) {
+			printf("-yash: new job\n");
 		}
+		handleNewJob(in_str, false);
 	}
+
+	// Check for finished jobs
+	maintainJobsTable();
 }
 
+
 /**
- * @brief Check if any background jobs finished.
+ * @brief Handle a line of input.
  *
- * Check if any previously running job in the jobs table has finished running.
+ * It is called by readline once a whole line is read.
  *
- * TODO: Implement
+ * @param	in_str	Input line, or NULL on EOF
  */
-void maintainJobsTable() {
-	// Check every job in the job_arr
-	for (int i=0; i<=last_job; i++) {
-		// Skip jobs that already finished
-		if (!strcmp(job_arr[i].status, JOB_STATUS_RUNNING) ||
-				!strcmp(job_arr[i].status, JOB_STATUS_STOPPED)) {
-			int status;
-			if (waitpid(job_arr[i].gpid, &status, WNOHANG|WUNTRACED|WCONTINUED) == SYSCALL_RETURN_ERR) {
-				printf("-yash: error checking child %d status: %d\n",
-						job_arr[i].gpid, errno);
-				// TODO: handle error
+void handleInput(char* in_str) {
+	if (!in_str) {
+		rl_callback_handler_remove();
+		shell_running = false;
+		return;
+	}
+
+	// Leave the terminal to the jobs while handling the line
+	setEventSource(STDIN_FILENO, 0);
+	rl_callback_handler_remove();
+
+	if (!ignoreInput(in_str)) {
+		add_history(in_str);
+	}
+	runLine(in_str);
+	free(in_str);
+
+	// Show the prompt again
+	if (setEventSource(STDIN_FILENO, EPOLLIN)) {
+		rl_callback_handler_install(PROMPT, handleInput);
+	}
+}
+
+
+/**
+ * @brief Event handler to read terminal input.
+ *
+ * @param	fd		Standard input
+ * @param	events	Ready events
+ * @param	data	Unused
+ */
+void readInput(int fd, uint32_t events, void* data) {
+	rl_callback_read_char();
+}
+
+
+/**
+ * @brief Check if a directory entry is an executable file.
+ *
+ * @param	dir		Directory path
+ * @param	name	Entry name
+ * @return	True if the entry is a regular file with any execute bit set
+ */
+bool isExecutable(const char* dir, const char* name) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path)) {
+		return (false);
+	}
+	return (stat(path, &st) != SYSCALL_RETURN_ERR && S_ISREG(st.st_mode) &&
+			(st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH)));
+}
+
+
+/**
+ * @brief Compare two names, for qsort() and bsearch().
+ */
+int cmpName(const void* a, const void* b) {
+	return (strcmp(*(char* const*)a, *(char* const*)b));
+}
+
+
+/**
+ * @brief Scan the executables of a PATH directory.
+ *
+ * The directory is watched for changes too, if it was not already.
+ *
+ * @param	dir	Directory to scan
+ */
+void scanExecDir(struct ExecDir* dir) {
+	for (size_t i=0; i<dir->len; i++) {
+		free(dir->names[i]);
+	}
+	dir->len = 0;
+	dir->stale = false;
+	exec_names_stale = true;
+
+	if (dir->wd == NO_FD && inotify_fd != NO_FD) {
+		dir->wd = inotify_add_watch(inotify_fd, dir->path, EXEC_WATCH_EVENTS);
+	}
+
+	DIR* d = opendir(dir->path);
+	if (!d) {
+		return;
+	}
+	struct dirent* ent;
+	while ((ent = readdir(d))) {
+		// Hidden files are not completed, and only files can be executed
+		if (ent->d_name[0] == '.' || ent->d_type == DT_DIR ||
+				!isExecutable(dir->path, ent->d_name)) {
+			continue;
+		}
+		if (dir->len == dir->cap) {
+			size_t cap = dir->cap ? dir->cap * 2 : 64;
+			char** names = realloc(dir->names, cap * sizeof(char*));
+			if (!names) {
+				break;
 			}
-			if (WIFEXITED(status)) {
-				if (verbose) {
-					printf("-yash: child process terminated normally\n");
-				}
+			dir->names = names;
+			dir->cap = cap;
+		}
+		dir->names[dir->len++] = strdup(ent->d_name);
+	}
+	closedir(d);
+	qsort(dir->names, dir->len, sizeof(char*), cmpName);
+}
 
-				// Change status to done and, remove child from array
-				strcpy(job_arr[i].status, JOB_STATUS_DONE);
-				printJob(i);
-				removeJob(i);
 
-			} else if (WIFSIGNALED(status)) {
-				if (verbose) {
-					printf("-yash: child process terminated by a signal\n");
-				}
+/**
+ * @brief Find where a name is, or should be, in a sorted array of names.
+ *
+ * @param	names	Sorted names
+ * @param	len		Number of names
+ * @param	name	Name to find
+ * @return	Index of the first name not sorted before the given one
+ */
+size_t findName(char** names, size_t len, const char* name) {
+	size_t lo = 0, hi = len;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strcmp(names[mid], name) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo);
+}
 
-				// Change status to done, and remove child from array
-				strcpy(job_arr[i].status, JOB_STATUS_DONE);
-				printJob(i);
-				removeJob(i);
-			} else if (WIFSTOPPED(status)) {
-				if (verbose) {
-					printf("-yash: child process stopped by a signal\n");
-				}
 
-				// Change status to stopped
-				strcpy(job_arr[i].status, JOB_STATUS_STOPPED);
-			} else if (WIFCONTINUED(status)) {
-				if (verbose) {
-					printf("-yash: child process continued by a signal\n");
+/**
+ * @brief Add a new executable name to the merged index.
+ *
+ * @param	name	Name, owned by a PATH directory
+ */
+void addExecName(char* name) {
+	size_t pos = findName(exec_names, exec_names_len, name);
+	if (pos < exec_names_len && !strcmp(exec_names[pos], name)) {
+		return;	// Already in another directory
+	}
+	if (exec_names_len == exec_names_cap) {
+		exec_names_stale = true;	// Merge it again with room to grow
+		return;
+	}
+	memmove(&exec_names[pos+1], &exec_names[pos],
+			(exec_names_len - pos) * sizeof(char*));
+	exec_names[pos] = name;
+	exec_names_len++;
+}
+
+
+/**
+ * @brief Remove an executable name from the merged index.
+ *
+ * The name stays if another PATH directory has it, or if it is a builtin, as
+ * the merged index keeps the builtin entry then.
+ *
+ * @param	name	Name, owned by a PATH directory, about to be freed
+ */
+void dropExecName(char* name) {
+	size_t pos = findName(exec_names, exec_names_len, name);
+	if (pos >= exec_names_len || exec_names[pos] != name) {
+		return;	// Merged from another directory
+	}
+	for (int i=0; i<exec_dirs_len; i++) {
+		struct ExecDir* dir = &exec_dirs[i];
+		size_t j = findName(dir->names, dir->len, name);
+		if (j < dir->len && dir->names[j] != name &&
+				!strcmp(dir->names[j], name)) {
+			exec_names[pos] = dir->names[j];
+			return;
+		}
+	}
+	memmove(&exec_names[pos], &exec_names[pos+1],
+			(exec_names_len - pos - 1) * sizeof(char*));
+	exec_names_len--;
+}
+
+
+/**
+ * @brief Check if a name of the merged index is a builtin.
+ *
+ * @param	name	Name of the merged index
+ * @return	True if the name is one of `exec_builtins`, false otherwise
+ */
+bool isBuiltinName(const char* name) {
+	for (size_t i=0; i<sizeof(exec_builtins)/sizeof(exec_builtins[0]); i++) {
+		if (name == exec_builtins[i]) {
+			return (true);
+		}
+	}
+	return (false);
+}
+
+
+/**
+ * @brief Add or remove a changed name of a PATH directory.
+ *
+ * The merged index is updated in place too, unless it has to be merged again
+ * anyway.
+ *
+ * @param	dir		Directory of the name
+ * @param	name	Changed name
+ */
+void updateExecName(struct ExecDir* dir, const char* name) {
+	size_t pos = findName(dir->names, dir->len, name);
+	bool found = pos < dir->len && !strcmp(dir->names[pos], name);
+	bool exec = name[0] != '.' && isExecutable(dir->path, name);
+
+	if (found && !exec) {
+		if (!exec_names_stale) {
+			dropExecName(dir->names[pos]);
+		}
+		free(dir->names[pos]);
+		memmove(&dir->names[pos], &dir->names[pos+1],
+				(dir->len - pos - 1) * sizeof(char*));
+		dir->len--;
+	} else if (!found && exec) {
+		if (dir->len == dir->cap) {	// Scan it again with room to grow
+			dir->stale = true;
+			return;
+		}
+		memmove(&dir->names[pos+1], &dir->names[pos],
+				(dir->len - pos) * sizeof(char*));
+		dir->names[pos] = strdup(name);
+		dir->len++;
+		if (!exec_names_stale) {
+			addExecName(dir->names[pos]);
+		}
+	}
+}
+
+
+/**
+ * @brief Event handler for the changes of the indexed PATH directories.
+ *
+ * @param	fd		inotify descriptor
+ * @param	events	Ready events
+ * @param	data	Unused
+ */
+void handleExecWatch(int fd, uint32_t events, void* data) {
+	char buf[INOTIFY_BUF_LEN]
+			__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char* p=buf; p<buf+len; ) {
+			struct inotify_event* ev = (struct inotify_event*) p;
+			p += sizeof(struct inotify_event) + ev->len;
+
+			// Scan everything again if events were lost
+			if (ev->mask & IN_Q_OVERFLOW) {
+				for (int i=0; i<exec_dirs_len; i++) {
+					exec_dirs[i].stale = true;
 				}
+				continue;
+			}
 
-				// Change status to running
-				strcpy(job_arr[i].status, JOB_STATUS_RUNNING);
+			for (int i=0; i<exec_dirs_len; i++) {
+				if (exec_dirs[i].wd != ev->wd) {
+					continue;
+				}
+				if (ev->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED)) {
+					// The watch is gone, set it again on the next scan
+					if (!(ev->mask & IN_IGNORED)) {
+						inotify_rm_watch(fd, ev->wd);
+					}
+					exec_dirs[i].wd = NO_FD;
+					exec_dirs[i].stale = true;
+				} else if (ev->len > 0) {
+					updateExecName(&exec_dirs[i], ev->name);
+				}
 			}
 		}
 	}
 }
 
+
 /**
- * @brief Send a SIGKILL to all jobs in the jobs list
+ * @brief Take the directories to index from PATH.
+ *
+ * Relative directories are skipped, as they change with the working directory.
  */
-void killAllJobs() {
-	for (int i=0; i<last_job; i++) {
-			// Skip jobs that already finished
-			if (!strcmp(job_arr[i].status, JOB_STATUS_RUNNING) ||
-					!strcmp(job_arr[i].status, JOB_STATUS_STOPPED)) {
-				kill(job_arr[i].gpid, SIGKILL);
+void resetExecDirs() {
+	const char* path = getenv("PATH");
+
+	for (int i=0; i<exec_dirs_len; i++) {
+		if (exec_dirs[i].wd != NO_FD) {
+			inotify_rm_watch(inotify_fd, exec_dirs[i].wd);
+		}
+		for (size_t j=0; j<exec_dirs[i].len; j++) {
+			free(exec_dirs[i].names[j]);
+		}
+		free(exec_dirs[i].names);
+	}
+	exec_dirs_len = 0;
+	exec_names_stale = true;
+	free(exec_path);
+	exec_path = strdup(path ? path : EMPTY_STR);
+
+	for (const char* p=exec_path; p && *p && exec_dirs_len<MAX_PATH_DIRS; ) {
+		size_t len = strcspn(p, ":");
+		struct ExecDir* dir = &exec_dirs[exec_dirs_len];
+		if (p[0] == '/' && len < sizeof(dir->path)) {
+			*dir = (struct ExecDir) { { 0 }, NO_FD, true, NULL, 0, 0 };
+			memcpy(dir->path, p, len);
+
+			// Skip repeated directories
+			bool repeated = false;
+			for (int i=0; i<exec_dirs_len; i++) {
+				repeated = repeated || !strcmp(exec_dirs[i].path, dir->path);
+			}
+			if (!repeated) {
+				exec_dirs_len++;
 			}
+		}
+		p += len + (p[len] == ':');
+	}
+}
+
+
+/**
+ * @brief Bring the index of executable names up to date.
+ *
+ * The index is built on first use. Then only the directories whose watch was
+ * lost are scanned again, while the others are updated from inotify events as
+ * they come. Without inotify, every directory is scanned on each call.
+ */
+void indexExecs() {
+	const size_t BUILTINS_LEN = sizeof(exec_builtins) / sizeof(exec_builtins[0]);
+	const char* path = getenv("PATH");
+
+	// Watch the directories from the event loop
+	if (inotify_fd == NO_FD && !exec_path) {
+		inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if (inotify_fd != NO_FD &&
+				!addEventSource(inotify_fd, EPOLLIN, handleExecWatch, NULL)) {
+			close(inotify_fd);
+			inotify_fd = NO_FD;
+		}
+	}
+
+	// Pick up the changes of the directories
+	if (inotify_fd != NO_FD) {
+		handleExecWatch(inotify_fd, EPOLLIN, NULL);
 	}
+	if (!exec_path || strcmp(exec_path, path ? path : EMPTY_STR)) {
+		resetExecDirs();
+	}
+	for (int i=0; i<exec_dirs_len; i++) {
+		if (exec_dirs[i].stale || inotify_fd == NO_FD) {
+			scanExecDir(&exec_dirs[i]);
+		}
+	}
+	if (!exec_names_stale) {
+		return;
+	}
+
+	// Merge the names of every directory and the builtins
+	size_t len = BUILTINS_LEN;
+	for (int i=0; i<exec_dirs_len; i++) {
+		len += exec_dirs[i].len;
+	}
+	if (len > exec_names_cap) {
+		char** names = realloc(exec_names, len * 2 * sizeof(char*));
+		if (!names) {
+			exec_names_len = 0;
+			return;
+		}
+		exec_names = names;
+		exec_names_cap = len * 2;
+	}
+	exec_names_len = 0;
+	for (size_t i=0; i<BUILTINS_LEN; i++) {
+		exec_names[exec_names_len++] = (char*) exec_builtins[i];
+	}
+	for (int i=0; i<exec_dirs_len; i++) {
+		memcpy(&exec_names[exec_names_len], exec_dirs[i].names,
+				exec_dirs[i].len * sizeof(char*));
+		exec_names_len += exec_dirs[i].len;
+	}
+	qsort(exec_names, exec_names_len, sizeof(char*), cmpName);
+
+	/*
+	 * Drop the names found in more than one place. Builtins are kept over the
+	 * executables with the same name, so deleting the file keeps the builtin.
+	 */
+	size_t unique = 0;
+	for (size_t i=0; i<exec_names_len; i++) {
+		if (unique == 0 || strcmp(exec_names[unique-1], exec_names[i])) {
+			exec_names[unique++] = exec_names[i];
+		} else if (isBuiltinName(exec_names[i])) {
+			exec_names[unique-1] = exec_names[i];
+		}
+	}
+	exec_names_len = unique;
+	exec_names_stale = false;
+}
+
+
+/**
+ * @brief Generate the command names starting with the text, for readline.
+ *
+ * @param	text	Text to complete
+ * @param	state	0 on the first call for the text
+ * @return	Next matching name, to be freed, or NULL when there are no more
+ */
+char* completeExecName(const char* text, int state) {
+	static size_t pos;
+	size_t text_len = strlen(text);
+
+	// Find the first name not sorted before the text
+	if (state == 0) {
+		indexExecs();
+		pos = findName(exec_names, exec_names_len, text);
+	}
+
+	if (pos < exec_names_len && !strncmp(exec_names[pos], text, text_len)) {
+		return (strdup(exec_names[pos++]));
+	}
+	return (NULL);
+}
+
+
+/**
+ * @brief Complete command names from the PATH index, for readline.
+ *
+ * Words in command position, at the start of the line or after a pipe, are
+ * completed from the index. Other words, and paths, are left to the filename
+ * completion of readline.
+ *
+ * @param	text	Word to complete
+ * @param	start	Start of the word in the line
+ * @param	end		End of the word in the line
+ * @return	Matches, or NULL to complete file names
+ */
+char** completeCommand(const char* text, int start, int end) {
+	int i = start - 1;
+	while (i >= 0 && isspace(rl_line_buffer[i])) {
+		i--;
+	}
+	if ((i >= 0 && rl_line_buffer[i] != '|') || strchr(text, '/')) {
+		return (NULL);
+	}
+	return (rl_completion_matches(text, completeExecName));
 }
 
 
@@ -876,16 +5307,41 @@ void killAllJobs() {
  * @return	Errorcode
  */
 int main(int argc, char** argv) {
-	const char USAGE[MAX_ERROR_LEN] = "\nUsage:\n"
+	const char USAGE[] = "\nUsage:\n"
 			"./yash [options]\n"
 			"\n"
 			"Options:\n"
-			"\t-v, --verbose\tVerbose output from shell\n";
+			"\t-v, --verbose\tVerbose output from shell\n"
+			"\t-z, --zygote\tSpawn commands from a pre-forked zygote process\n"
+			"\t--server PATH\tRun the command lines sent to the Unix socket PATH\n"
+			"\t-c COMMAND\tRun COMMAND and exit with its status\n"
+			"\t--startup-profile\tReport the time of each startup stage\n";
 	const char ARG_ERROR[MAX_ERROR_LEN] = "-yash: unknown argument: ";
 	const char V_FLAG_SHORT[3] = "-v\0";
 	const char V_FLAG_LONG[10] = "--verbose\0";
 	const char V_INFO[MAX_ERROR_LEN] = "-yash: verbose output set\n";
-	char* in_str;
+	const char Z_FLAG_SHORT[3] = "-z\0";
+	const char Z_FLAG_LONG[9] = "--zygote\0";
+	const char S_FLAG_LONG[9] = "--server\0";
+	const char C_FLAG_SHORT[3] = "-c\0";
+	const char P_FLAG_LONG[18] = "--startup-profile\0";
+	char* server_path = NULL;
+	char* cmd_str = NULL;
+	uint64_t start = nowNs();
+	uint64_t since = start;
+
+	// Run as the zygote of a shell, @sa startZygote()
+	if (argc >= 3 && !strcmp(ZYGOTE_ARG, argv[1])) {
+		long fd;
+		if (parseNumber(argv[2], 0, INT32_MAX, &fd)) {
+			verbose = argc > 3;
+			runZygote(fd);
+		}
+		return (EXIT_ERR);
+	}
+
+	// Batch the output of the shell
+	initOutput();
 
 	// Read command line arguments
 	verbose = false;
@@ -895,6 +5351,15 @@ int main(int argc, char** argv) {
 					|| !strcmp(V_FLAG_LONG, argv[i])) {
 				verbose = true;
 				printf(V_INFO);
+			} else if (!strcmp(Z_FLAG_SHORT, argv[i])
+					|| !strcmp(Z_FLAG_LONG, argv[i])) {
+				shell_opts[OPT_ZYGOTE].value = true;
+			} else if (!strcmp(S_FLAG_LONG, argv[i]) && i+1 < argc) {
+				server_path = argv[++i];
+			} else if (!strcmp(C_FLAG_SHORT, argv[i]) && i+1 < argc) {
+				cmd_str = argv[++i];
+			} else if (!strcmp(P_FLAG_LONG, argv[i])) {
+				startup_profile = true;
 			} else {
 				printf(ARG_ERROR);
 				printf("%s\n", argv[i]);
@@ -904,8 +5369,27 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	// Initialize the shell
-	initShell();
+	profileStage("args", &since);
+
+	// Initialize the shell, the prompt is only for terminal users
+	interactive = !cmd_str && !server_path && isatty(STDIN_FILENO);
+	initShell(&since);
+	if (startup_profile) {
+		fprintf(stderr, "-yash: startup total usec=%.1f\n",
+				(since - start) / 1000.0);
+	}
+
+	// Serve commands from a socket instead of the terminal
+	if (server_path) {
+		return (runServer(server_path));
+	}
+
+	// Run a single command line, and leave its background jobs running
+	if (cmd_str) {
+		runLine(cmd_str);
+		stopZygote();
+		return (last_status);
+	}
 
 	/*
 	 * Use `readline()` to control when to exit from the shell. Typing
@@ -915,41 +5399,40 @@ int main(int argc, char** argv) {
 	 * "If readline encounters an EOF while reading the line, and the line is
 	 * empty at that point, then (char *)NULL is returned. Otherwise, the line
 	 * is ended just as if a newline had been typed."
+	 *
+	 * Input is read through the readline callback interface from the event
+	 * loop, so background job output is drained while the prompt is shown.
+	 * Input that is not a terminal, like a script, is read line by line right
+	 * away, with no prompt.
 	 */
-	while ((in_str = readline("# "))) {
-		// Check input to ignore and show the prompt again
-		if (verbose) {
-			printf("-yash: checking if input should be ignored...\n");
-		}
-
-		// Check if input should be ignored
-		if (ignoreInput(in_str)) {
-			if (verbose) {
-				printf("-yash: input ignored\n");
-			}
-		} else if (runShellCmd(in_str)) {	// Check if input is a shell command
-			if (verbose) {
-				printf("-yash: ran shell command\n");
-			}
-		} else {	// Handle new job
-			if (verbose) {
-				printf("-yash: new job\n");
-			}
-			handleNewJob(in_str);
+	shell_running = true;
+	if (interactive && addEventSource(STDIN_FILENO, EPOLLIN, readInput, NULL)) {
+		rl_callback_handler_install(PROMPT, handleInput);
+		while (shell_running && runEvents(-1));
+		rl_callback_handler_remove();
+	} else {
+		char* in_str;
+		while ((in_str = readLine(PROMPT))) {
+			runLine(in_str);
+			free(in_str);
+			runEvents(0);
 		}
-
-		// Check for finished jobs
-		maintainJobsTable();
 	}
 
 	// Ensure a new-line on exit
-	printf("\n");
+	if (interactive) {
+		printf("\n");
+	}
 	if (verbose) {
 		printf("-yash: exiting...\n");
 	}
-	killAllJobs();
+	if (interactive) {	// Scripts leave their background jobs running, like sh
+		killAllJobs();
+	}
+	stopZygote();
 
 	// TODO: Ensure all child processes are dead on exit
 
-	return (EXIT_OK);
+	// Scripts exit with the status of their last command
+	return (interactive ? EXIT_OK : last_status);
 }
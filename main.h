@@ -9,13 +9,18 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#define _GNU_SOURCE	// Linux specific calls: memfd_create(), pipe2(), etc.
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <sys/types.h>
@@ -23,6 +28,23 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/ioprio.h>
 
 #define MAX_CMD_LEN 2000	//! Max command length as per requirements
 #define MAX_TOKEN_LEN 30	//! Max token length as per requirements
@@ -45,6 +67,24 @@
 #define CHILD_COUNT_SIMPLE 1	//! Number of children processes in a simple command without pipes
 #define CHILD_COUNT_PIPE 2		//! Number of children processes in a command with a pipe
 #define SYSCALL_RETURN_ERR -1	//! Value returned on a system call error
+#define MAX_PROC_SUBS 8			//! Max number of process substitutions per job
+#define PROC_SUB_PATH_LEN 24	//! Max length of a "/dev/fd/N" path
+#define NO_FD -1				//! Value of an unused file descriptor
+#define MAX_JOB_PROCS (CHILD_COUNT_PIPE+MAX_PROC_SUBS+1)	//! Max processes per job: stages, substitutions and pipe meter
+
+#define PSUB_ARG 0			//! Process substitution used as an argument
+#define PSUB_REDIR_IN 1		//! Process substitution used as input redirection, `< <(cmd)`
+#define PSUB_REDIR_OUT 2	//! Process substitution used as output redirection, `> >(cmd)`
+#define PSUB_REDIR_ERR 3	//! Process substitution used as error redirection, `2> >(cmd)`
+
+#define HERE_NONE 0	//! No here-document or here-string input
+#define HERE_DOC 1	//! Here-document input, `<< DELIM`
+#define HERE_STR 2	//! Here-string input, `<<< WORD`
+#define HERE_DOC_PROMPT "> "	//! Prompt shown while reading a here-document
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1UL << 2)	//! Signal the process group of a pidfd (Linux 6.9)
+#endif
 
 #define EMPTY_STR "\0"
 #define EMPTY_ARRAY -1
@@ -52,6 +92,60 @@
 #define CMD_BG "bg\0"		//! Shell command bg, @sa bg()
 #define CMD_FG "fg\0"		//! Shell command fg, @sa fg()
 #define CMD_JOBS "jobs\0"	//! Shell command jobs, @sa jobs()
+#define CMD_SET "set\0"		//! Shell command set, @sa setExec()
+#define CMD_WAIT "wait\0"	//! Shell command wait, @sa waitExec()
+
+#define PREFIX_NICE "nice\0"		//! Job prefix to set the nice value
+#define PREFIX_TASKSET "taskset\0"	//! Job prefix to set the CPU affinity
+#define PREFIX_IONICE "ionice\0"		//! Job prefix to set the I/O priority
+#define PREFIX_PIPESIZE "pipesize\0"	//! Job prefix to set the pipe buffer size
+#define PIPESIZE_AUTO "auto\0"			//! Pipe size to grow the pipe as needed
+#define PREFIX_TIMEOUT "timeout\0"		//! Job prefix to set a deadline
+#define DEFAULT_NICE 10				//! Nice increment when none is given
+
+#define PIPE_MAX_SIZE_PATH "/proc/sys/fs/pipe-max-size"	//! Max pipe size
+#define PIPE_SAMPLE_NSEC 5000000	//! Pipe fill level sampling period (5 ms)
+#define PIPE_FULL_SAMPLES 2			//! Full samples in a row to grow a pipe
+#define METER_CHUNK (1024*1024)		//! Max bytes moved by each splice() call
+#define NSEC_PER_SEC 1000000000L	//! Nanoseconds per second
+#define NSEC_PER_MSEC 1000000L		//! Nanoseconds per millisecond
+#define MAX_DURATION_SEC 1e9		//! Max duration of a job deadline
+#define DEFAULT_KILL_AFTER_NSEC (2*NSEC_PER_SEC)	//! Time from SIGTERM to SIGKILL on timeout
+#define EXIT_KILL_AFTER_MSEC 1000	//! Time from SIGTERM to SIGKILL for jobs left on exit
+#define BYTES_PER_MB (1024.0*1024.0)	//! Bytes per megabyte
+#define ZYGOTE_FDS 3				//! Descriptors passed to the zygote: stdin, stdout, stderr
+#define ZYGOTE_ARG "--zygote-fd"	//! Internal argument to run as the zygote, @sa startZygote()
+#define ZYGOTE_STACK_LEN (256*1024)	//! Stack of the stages spawned by the zygote
+#define SELF_EXE "/proc/self/exe"	//! Executable of the running process
+#define STD_FDS 3					//! Standard descriptors: stdin, stdout, stderr
+
+#define MAX_EVENT_SOURCES 256	//! Max number of descriptors in the event loop
+#define MAX_EVENTS 32			//! Max events handled per event loop iteration
+#define SERVER_MAX_CLIENTS 32	//! Max number of concurrent server clients
+#define SERVER_BACKLOG 16		//! Pending connections on the server socket
+#define SERVER_BUF_LEN 65536	//! Server output buffer size per client
+#define SERVER_HDR_LEN 32		//! Room kept in the output buffer for a reply header
+#define SERVER_REQ_RUN 'R'		//! Request to run a command discarding its output
+#define SERVER_REQ_CAPTURE 'C'	//! Request to run a command capturing its output
+#define SERVER_REP_OUTPUT 'O'	//! Reply with a chunk of captured output
+#define SERVER_REP_EXIT 'X'		//! Reply with the exit status of a command
+#define DEV_NULL "/dev/null"	//! Input and discarded output of server jobs
+#define PROMPT "# "				//! Shell prompt
+#define LINE_BLOCK_LEN 4096		//! Script input read at once when stdin is seekable
+#define MAX_PATH_DIRS 64		//! Max PATH directories indexed for command completion
+#define EXEC_WATCH_EVENTS (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|\
+		IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF)	//! Changes of the indexed directories
+#define INOTIFY_BUF_LEN 4096	//! inotify events read at once
+#define PLAN_CACHE_SIZE 16		//! Parsed command lines kept in the plan cache
+#define FNV_OFFSET 14695981039346656037ULL	//! FNV-1a hash offset basis
+#define FNV_PRIME 1099511628211ULL	//! FNV-1a hash prime
+#define OUT_BUF_LEN 65536		//! Shell output batched between flushes, @sa flushOutput()
+#define MAX_BRACE_GROUPS 8		//! Max brace groups expanded per word
+#define MAX_BRACE_SEQ (1L<<60)	//! Max absolute value of a sequence bound
+#define MAX_SEQ_LEN 21			//! Max length of a sequence item, a long
+#define MAX_BRACE_ITEM_LEN (MAX_CMD_LEN+MAX_BRACE_GROUPS*MAX_SEQ_LEN)	//! Max length of an expanded word
+#define RING_DEFAULT_SIZE 65536	//! Default size of background job output buffers
+#define RING_CHUNK 65536		//! Max bytes read from a job output pipe at once
 
 #define JOB_STATUS_RUNNING "Running\0"	//! Shell job status running
 #define JOB_STATUS_STOPPED "Stopped\0"	//! Shell job status stopped
@@ -61,6 +155,297 @@
 #define EXIT_ERR 1		//! Unknown error
 #define EXIT_ERR_ARG 2	//! Wrong argument provided
 #define EXIT_ERR_CMD 3	//! Command syntax error
+#define EXIT_TIMEOUT 124	//! Job killed on timeout, as in timeout(1)
+#define EXIT_NO_JOB 127		//! No job to wait for
+#define EXIT_SIGNAL 128		//! Added to the signal number of a process killed by a signal
+
+
+/**
+ * @brief Struct to organize a process substitution.
+ *
+ * A process substitution `<(cmd)` or `>(cmd)` runs `cmd` concurrently with the
+ * job stage (`cmd1` or `cmd2`) that has it as an argument. Both are connected
+ * through a pipe, and the argument is rewritten to `/dev/fd/N`, where `N` is
+ * the end of the pipe kept open by the stage.
+ *
+ * The arguments of `cmd` are saved in the `psub_argv` array of the job,
+ * starting at `argv_idx`, and terminated by a `NULL` pointer.
+ *
+ * A substitution can also be the target of a redirection of the stage, like
+ * `cat < <(cmd)`. Then `redir` is the kind of redirection, and the path is
+ * copied to the redirection of the stage instead.
+ */
+struct ProcSub {
+	uint32_t argv_idx;					// Index of the command in psub_argv
+	bool out;							// Output substitution >(cmd) boolean
+	uint8_t stage;						// Stage that uses it (1 or 2)
+	uint8_t redir;						// Redirection it is the target of, or PSUB_ARG
+	int fd;								// Pipe end used by the stage
+	pid_t pid;							// PID of the substitution process
+	char path[PROC_SUB_PATH_LEN];		// Argument passed to the stage
+};
+
+
+/**
+ * @brief Struct to organize a brace group of a word.
+ *
+ * A group is either a list `{a,b,c}`, or a sequence `{1..9}`, `{9..1..2}` or
+ * `{a..z}`. Sequences with a bound starting with `0` are zero-padded to the
+ * width of the longest bound.
+ *
+ * The current item is `pos`. For a list, `item` points to its first char.
+ */
+struct BraceGroup {
+	char* start;						// Opening brace in the word
+	char* end;							// Closing brace in the word
+	bool seq;							// Sequence boolean, list otherwise
+	bool alpha;							// Sequence of characters boolean
+	long from;							// First value of the sequence
+	long step;							// Step of the sequence, negative to count down
+	int width;							// Zero-padded width (0 for none)
+	uint64_t count;						// Number of items
+	uint64_t pos;						// Current item
+	char* item;							// Current item of the list
+};
+
+
+/**
+ * @brief Struct to organize the lazy expansion of the brace groups of a word.
+ *
+ * The words are generated one at a time, in the order of Bash, so a range of
+ * any size is expanded without keeping the list in memory. Braces are not
+ * nested, and a group without a comma or a valid sequence is left as is.
+ * @sa nextBrace()
+ */
+struct BraceGen {
+	char* word;							// Word to expand
+	struct BraceGroup group[MAX_BRACE_GROUPS];	// Brace groups of the word
+	uint8_t len;						// Number of brace groups
+	bool done;							// Every word generated boolean
+};
+
+
+/**
+ * @brief Struct to organize the content of a here-document or here-string.
+ *
+ * Content is written to a non-blocking pipe while it fits in the pipe buffer,
+ * so the command can read it without any file backing it. If it grows larger,
+ * it is moved to a memfd_create() file, and `mem` is set to `1`.
+ *
+ * `fd` is the descriptor read by the command, and `wfd` the write end of the
+ * pipe (NO_FD when using a memfd).
+ */
+struct HereBuf {
+	int fd;								// Descriptor to read the content
+	int wfd;							// Pipe write end
+	size_t len;							// Bytes of content written
+	bool mem;							// Memfd backed content boolean
+};
+
+
+/**
+ * @brief Struct to organize the scheduling parameters of a job.
+ *
+ * The parameters are set with the `nice`, `taskset` and `ionice` job prefixes,
+ * and applied to every process of the job after fork() and before exec(). Each
+ * parameter is only applied if its `*_set` boolean is `1`, so a zeroed struct
+ * keeps the parameters of the shell.
+ *
+ * If `spread` is `1`, each stage of the job is pinned to a different CPU out of
+ * the allowed ones, saved to `stage_cpu` when the job is run.
+ */
+struct SchedAttr {
+	cpu_set_t cpus;						// CPU affinity mask
+	bool cpus_set;						// CPU affinity set boolean
+	int nice;							// Nice value
+	bool nice_set;						// Nice value set boolean
+	int ioprio;							// I/O class and priority
+	bool ioprio_set;					// I/O priority set boolean
+	bool spread;						// Spread stages across CPUs boolean
+	int stage_cpu[CHILD_COUNT_PIPE];	// CPU of each stage when spread
+};
+
+
+/**
+ * @brief Struct to organize the statistics of a metered pipe.
+ *
+ * With the `pipemeter` shell option, the pipe between the stages of a job is
+ * split in two, and a helper process relays the data between them with
+ * splice(). The helper updates this struct, which lives in memory shared with
+ * the shell, so the statistics can be read while the job runs.
+ *
+ * Time spent by the helper waiting for the left stage to write (`wait_in_ns`)
+ * means the job is producer-bound. Time spent waiting for the right stage to
+ * read (`wait_out_ns`) means it is consumer-bound. @sa relayPipe()
+ */
+struct PipeMeter {
+	uint64_t bytes;						// Bytes relayed
+	uint64_t wait_in_ns;				// Time waiting for the left stage
+	uint64_t wait_out_ns;				// Time waiting for the right stage
+	uint64_t start_ns;					// Time the relay started
+	uint64_t end_ns;					// Time the relay ended (0 if running)
+};
+
+
+/**
+ * @brief Struct to organize a request to the zygote process.
+ *
+ * The shell sends one request per stage to spawn over a socket, along with the
+ * descriptors to use as stdin, stdout and stderr (SCM_RIGHTS). The arguments of
+ * the command are saved to `argv`, separated by `\0` chars. File redirections
+ * are done by the spawned process, as with a forked one.
+ *
+ * The zygote replies with the PID of the new process, or SYSCALL_RETURN_ERR.
+ * @sa runZygote()
+ */
+struct ZygoteReq {
+	pid_t pgid;							// Process group to join (0 for a new one)
+	uint8_t stage;						// Stage run by the process (1 or 2)
+	struct SchedAttr sched;				// Scheduling parameters
+	char in[MAX_TOKEN_LEN+1];			// Input redirection
+	char out[MAX_TOKEN_LEN+1];			// Output redirection
+	char err[MAX_TOKEN_LEN+1];			// Error redirection
+	uint32_t argc;						// Number of arguments
+	char argv[MAX_CMD_LEN+1];			// Arguments
+};
+
+
+/**
+ * @brief Struct to organize a job stage spawned by the zygote.
+ *
+ * The stage runs in the memory of the zygote, which is stopped until the stage
+ * calls exec(). @sa runZygoteStage()
+ */
+struct ZygoteStage {
+	struct ZygoteReq* req;				// Request of the shell
+	int* fds;							// Descriptors to use as stdin, stdout and stderr
+	int sock;							// Socket to the shell, closed by the stage
+	char** args;						// Expanded arguments, or NULL, freed by the zygote
+};
+
+
+/**
+ * @brief Struct to organize the captured output of a background job.
+ *
+ * With the `bgcapture` shell option, the stdout and stderr of background jobs
+ * go to a pipe drained by the event loop into a ring buffer of `size` bytes,
+ * instead of the terminal. Only the last `size` bytes are kept: older output
+ * is appended to a memfd_create() file if `spill` is `1`, or dropped
+ * otherwise. @sa writeRingBuf()
+ *
+ * The buffered output is shown with `jobs -o %N`.
+ */
+struct RingBuf {
+	int fd;								// Output pipe read end (NO_FD at EOF)
+	bool spill;							// Spill old output to a memfd boolean
+	int spill_fd;						// Spilled output, or NO_FD
+	uint64_t spilled;					// Bytes in spill_fd
+	uint64_t dropped;					// Bytes dropped
+	size_t size;						// Capacity of data
+	size_t start;						// Index of the oldest byte in data
+	size_t len;							// Bytes in data
+	char data[];						// Buffered output
+};
+
+
+/**
+ * @brief Struct to organize the executables of a PATH directory.
+ *
+ * The directory is scanned once, on the first command completion, and the
+ * names are kept sorted. Then they are updated one by one from the inotify
+ * events of the directory, instead of scanning it again. @sa indexExecs()
+ */
+struct ExecDir {
+	char path[PATH_MAX];				// Directory path
+	int wd;								// inotify watch descriptor, or NO_FD
+	bool stale;							// Scan the directory again boolean
+	char** names;						// Sorted executable names
+	size_t len;							// Number of names
+	size_t cap;							// Capacity of names
+};
+
+
+/**
+ * @brief Struct to organize a process of a job.
+ *
+ * Every process of a job is tracked with a pidfd opened right after it is
+ * spawned. As the process is an unreaped child of the shell by then, the pidfd
+ * refers to it, and only to it, even after it exits and its PID is reused.
+ * Pidfds are kept open until the job is removed. @sa signalJob()
+ *
+ * Once the process is reaped, its status is saved to `status`.
+ */
+struct JobProc {
+	pid_t pid;							// Process PID
+	int pidfd;							// Process pidfd, or NO_FD
+	bool reaped;						// Process reaped boolean
+	int status;							// Exit status, once reaped
+};
+
+
+/**
+ * @brief Struct to organize a shell option.
+ *
+ * Options are set with the `set` shell command. Boolean options are `0` or `1`.
+ */
+struct ShellOpt {
+	const char* name;					// Option name
+	int value;							// Option value
+};
+
+
+/**
+ * @brief Event handler called by the event loop.
+ *
+ * @param	fd		Ready descriptor
+ * @param	events	Ready events (EPOLLIN, EPOLLOUT, EPOLLHUP, etc.)
+ * @param	data	Data given when the descriptor was added
+ */
+typedef void (*EventHandler)(int fd, uint32_t events, void* data);
+
+
+/**
+ * @brief Struct to organize a descriptor watched by the event loop.
+ *
+ * A source with no `events` is paused: it is kept in the table, but removed
+ * from the epoll set, so a hung up descriptor does not wake up the loop until
+ * it is resumed. @sa setEventSource()
+ */
+struct EventSource {
+	int fd;								// Watched descriptor (NO_FD if unused)
+	uint32_t events;					// Watched events (0 if paused)
+	EventHandler handler;				// Called when the descriptor is ready
+	void* data;							// Passed to the handler
+};
+
+
+/**
+ * @brief Struct to organize a client of the command server.
+ *
+ * Each client sends one request per line: `R cmd` to run `cmd` discarding its
+ * output, or `C cmd` to run it capturing its stdout and stderr. The server
+ * replies with `O LEN\n` followed by `LEN` bytes for every chunk of captured
+ * output, and `X STATUS\n` when the command is done. Requests of a client are
+ * run in order, one at a time, while requests of different clients run
+ * concurrently. @sa runServer()
+ *
+ * The job run for the client is `job_idx`, and the read end of the pipe where
+ * its output is captured is `cap_fd`. The command is done when both are
+ * closed.
+ */
+struct Client {
+	bool used;							// Slot in use boolean
+	int fd;								// Client socket (NO_FD if disconnected)
+	bool eof;							// Client sent all its requests boolean
+	char in_buf[MAX_CMD_LEN+3];			// Requests received
+	size_t in_len;						// Bytes in in_buf
+	char out_buf[SERVER_BUF_LEN];		// Replies not sent yet
+	size_t out_len;						// Bytes in out_buf
+	size_t out_pos;						// Bytes of out_buf already sent
+	int job_idx;						// Job run for the client, or EMPTY_ARRAY
+	int cap_fd;							// Captured output, or NO_FD
+	int status;							// Exit status of the last command
+};
 
 
 /**
@@ -79,9 +464,46 @@
  * `in1`, `in2`, `out1`, `out2`, `err1` and `err2` attributes. If any of those
  * struct members is `"\0"`, they are assumed to use their default files stdin,
  * stdout or stderr.
-  *
+ *
+ * Here-documents (`<< DELIM`) and here-strings (`<<< WORD`) are saved in the
+ * `here1` and `here2` attributes, with their kind in `here1_type` and
+ * `here2_type`. Their content is loaded to an in-memory file before running the
+ * job, and its descriptor is saved to `here1_fd` and `here2_fd`. It replaces
+ * any other input of the command. @sa openHereDoc()
+ *
+ * Process substitutions are saved to `psub`, and the number of them to
+ * `psub_len`. The command strings of the substitutions are copied to
+ * `psub_str`, and tokenized into `psub_argv`. @sa ProcSub
+ *
  * If the command is to be run in the background, `bg` should be set to `1`, or
- * `0` for foreground.
+ * `0` for foreground. The output of a background job captured by the shell is
+ * kept in `ring`. @sa RingBuf
+ *
+ * The scheduling parameters set with job prefixes are saved to `sched`. The
+ * PIDs of the stages are saved to `pids` when the job is run.
+ *
+ * The pipe buffer size set with the `pipesize` prefix is saved to `pipe_size`
+ * (`0` to use the `pipesize` shell option). If the pipe should grow when the
+ * left stage blocks on it, `pipe_auto` is `1`. @sa tunePipe()
+ *
+ * If the pipe is metered, its statistics are in `meter`, and a copy of them
+ * from the last time they were shown is in `meter_last`. @sa PipeMeter
+ *
+ * A job run with the `timeout` prefix, or the `jobtimeout` shell option, is
+ * sent SIGTERM `timeout_ns` after it starts, and SIGKILL `kill_after_ns` later.
+ * Its deadline is `deadline_ns`, and its position in the timer heap
+ * `timer_idx` (EMPTY_ARRAY if it has no deadline). Once it is signaled,
+ * `timed_out` is `1`. @sa setJobDeadline()
+ *
+ * Every process of the job is saved to `procs`, along with a pidfd to signal
+ * it. @sa JobProc
+ *
+ * The number of processes of the job that have not been reaped yet is kept in
+ * `child_count`. When the last stage exits, its exit status (or 128 plus the
+ * number of the signal that killed it) is saved to `exit_status`.
+ *
+ * Jobs run for a command server client keep the client index in `client`, or
+ * EMPTY_ARRAY otherwise. @sa Client
  *
  * If there is an error parsing or setting any part of the command, `err_msg`
  * must be set to the error message string. Else, `err_msg` must be set to
@@ -95,43 +517,255 @@ struct Job {
 	char in1[MAX_TOKEN_LEN+1];			// Cmd1 input redirection
 	char out1[MAX_TOKEN_LEN+1];			// Cmd1 output redirection
 	char err1[MAX_TOKEN_LEN+1];			// Cmd1 error redirection
+	char* here1;						// Cmd1 here-document delimiter or here-string
+	uint8_t here1_type;					// Cmd1 here-document or here-string input
+	int here1_fd;						// Cmd1 here-document or here-string content
 	char* cmd2[MAX_TOKEN_NUM];			// Second command if there is a pipe
 	char in2[MAX_TOKEN_LEN+1];			// Cmd2 input redirection
 	char out2[MAX_TOKEN_LEN+1];			// Cmd2 output redirection
 	char err2[MAX_TOKEN_LEN+1];			// Cmd2 error redirection
+	char* here2;						// Cmd2 here-document delimiter or here-string
+	uint8_t here2_type;					// Cmd2 here-document or here-string input
+	int here2_fd;						// Cmd2 here-document or here-string content
+	struct ProcSub psub[MAX_PROC_SUBS];	// Process substitutions
+	uint8_t psub_len;					// Number of process substitutions
+	char* psub_argv[MAX_TOKEN_NUM];		// Process substitution commands
+	char psub_str[MAX_CMD_LEN+1];		// Process substitution tokens
 	bool pipe;							// Pipe boolean
+	int pipe_size;						// Pipe buffer size
+	bool pipe_auto;						// Pipe buffer auto-sizing boolean
+	ino_t pipe_ino;						// Pipe inode, to find it in /proc
+	uint8_t pipe_full;					// Samples in a row with a full pipe
+	struct PipeMeter* meter;			// Pipe statistics (shared memory)
+	struct PipeMeter meter_last;		// Pipe statistics last shown
 	bool bg;							// Background process boolean
+	struct RingBuf* ring;				// Captured output, or NULL
+	struct SchedAttr sched;				// Scheduling parameters
+	uint64_t timeout_ns;				// Time from start to SIGTERM (0 for none)
+	uint64_t kill_after_ns;				// Time from SIGTERM to SIGKILL
+	uint64_t deadline_ns;				// Time of the next signal
+	int timer_idx;						// Position in timer_heap
+	bool timed_out;						// Job signaled on timeout boolean
 	pid_t gpid;							// Group PID
+	pid_t pids[CHILD_COUNT_PIPE];		// PID of each stage
+	struct JobProc procs[MAX_JOB_PROCS];	// Every process of the job
+	uint8_t proc_len;					// Number of processes in procs
+	uint8_t child_count;				// Number of processes not reaped yet
+	int exit_status;					// Exit status of the last stage
+	int client;							// Server client of the job
 	uint8_t jobno;						// Job number
 	char status[MAX_STATUS_LEN];		// Status of the process group
 	char err_msg[MAX_ERROR_LEN];		// Error message
 };
 
 
+/**
+ * @brief Struct to organize a parsed command line kept in the plan cache.
+ *
+ * The tokens and arguments of `job` point into its own `cmd_str`, so they are
+ * moved to the `cmd_str` of the job slot the plan is copied to.
+ * @sa loadPlan()
+ *
+ * Plans are looked up by the hash of the input line, and the line is compared
+ * too. The least recently used plan is replaced by a new one.
+ */
+struct Plan {
+	uint64_t hash;						// Hash of line
+	uint64_t used;						// Last use tick (0 for a free entry)
+	char line[MAX_CMD_LEN+1];			// Input command line
+	struct Job job;						// Parsed job
+};
+
+
+// Shell options, @sa setExec()
+#define OPT_CPUSPREAD 0	//! Spread the stages of every job across CPUs
+#define OPT_PIPESIZE 1	//! Pipe buffer size in bytes (0 for the system default)
+#define OPT_PIPEAUTO 2	//! Grow pipe buffers when the left stage blocks
+#define OPT_PIPEMETER 3	//! Relay pipes through a helper that measures them
+#define OPT_ZYGOTE 4	//! Spawn job stages from the zygote process
+#define OPT_BGCAPTURE 5	//! Capture the output of background jobs
+#define OPT_BGBUFSIZE 6	//! Background job output buffer size in bytes
+#define OPT_BGSPILL 7	//! Spill old background job output to a memfd
+#define OPT_JOBTIMEOUT 8	//! Default job timeout in seconds (0 for none)
+#define OPT_PLANCACHE 9	//! Reuse the parsed jobs of repeated command lines
+#define OPT_NUM 10		//! Number of shell options
+
 // Globals
 static uint8_t verbose;							//! Verbose output flag
+static char out_buf[OUT_BUF_LEN];				//! Shell output buffer
+static struct ShellOpt shell_opts[OPT_NUM] = {	//! Shell options
+		{ "cpuspread", false },
+		{ "pipesize", 0 },
+		{ "pipeauto", false },
+		{ "pipemeter", false },
+		{ "zygote", false },
+		{ "bgcapture", false },
+		{ "bgbufsize", RING_DEFAULT_SIZE },
+		{ "bgspill", false },
+		{ "jobtimeout", 0 },
+		{ "plancache", true }
+};
+static int next_cpu;							//! Next CPU to spread stages on
+static int pipe_max_size;						//! Max pipe buffer size
+static int zygote_fd = NO_FD;					//! Socket to the zygote process
+static pid_t zygote_pid;						//! PID of the zygote process
 static struct Job job_arr[MAX_CONCURRENT_JOBS];	//! Current jobs array
 static int last_job = EMPTY_ARRAY;				//! Last job index in job_arr
+static int epoll_fd = NO_FD;					//! Event loop epoll instance
+static struct EventSource event_srcs[MAX_EVENT_SOURCES];	//! Event loop descriptors
+static int signal_fd = NO_FD;					//! Signals handled by the event loop
+static int timer_fd = NO_FD;					//! Timer of the earliest job deadline
+static int timer_heap[MAX_CONCURRENT_JOBS];		//! Jobs with a deadline, as a min-heap
+static int timer_len;							//! Number of jobs in timer_heap
+static struct Client clients[SERVER_MAX_CLIENTS];	//! Command server clients
+static int null_fd = NO_FD;						//! Server jobs input and discarded output
+static bool server_running;						//! Command server loop running flag
+static bool shell_running;						//! Interactive loop running flag
+static bool interrupted;						//! SIGINT received while waiting flag
+static int last_status;							//! Exit status of the last command
+static bool job_control;						//! Jobs take the terminal flag, stdin is a terminal
+static bool interactive;						//! Prompt, line editing and history flag
+static bool startup_profile;					//! Report the time of each startup stage flag
+static struct ExecDir exec_dirs[MAX_PATH_DIRS];	//! PATH directories indexed for completion
+static int exec_dirs_len;						//! Number of directories in exec_dirs
+static char* exec_path;							//! PATH the directories were taken from
+static const char* exec_builtins[] = {			//! Builtins completed as commands
+		CMD_BG, CMD_FG, CMD_JOBS, CMD_SET, CMD_WAIT
+};
+static char** exec_names;						//! Sorted executable and builtin names
+static size_t exec_names_len;					//! Number of names in exec_names
+static size_t exec_names_cap;					//! Capacity of exec_names
+static bool exec_names_stale = true;			//! Merge exec_names again flag
+static int inotify_fd = NO_FD;					//! Watches of the indexed directories
+static struct Plan plan_cache[PLAN_CACHE_SIZE];	//! Parsed command lines, @sa loadPlan()
+static uint64_t plan_tick;						//! Plan cache use counter
+static uint64_t plan_hits;						//! Jobs loaded from the plan cache
+static uint64_t plan_misses;					//! Jobs parsed from scratch
 
 
 // Functions
-void initShell();
+void profileStage(const char* stage, uint64_t* since);
+void initOutput();
+void flushOutput();
+void initShell(uint64_t* since);
+char* readLine(const char* prompt);
 bool ignoreInput(char* input_str);
+void resetChildSignals();
 void removeJob(int job_idx);
+struct RingBuf* newRingBuf(size_t size, bool spill);
+void evictRingBuf(struct RingBuf* ring, size_t len);
+void writeRingBuf(struct RingBuf* ring, const char* data, size_t len);
+void drainRingBuf(int fd, uint32_t events, void* data);
+void printRingBuf(struct RingBuf* ring);
+void freeRingBuf(struct RingBuf* ring);
+int findFreeJob();
 void printJob(int job_idx);
+void formatCpuSet(cpu_set_t* cpus, char* str, size_t len);
+void printJobPlacement(int job_idx);
+uint64_t nowNs();
+void printPipeMeter(struct Job* cmd);
+int findJob(char* spec);
 void bgExec();
 void fgExec();
-void jobsExec();
-bool runShellComd(char* input);
+void jobsExec(int argc, char** argv);
+void setExec(int argc, char** argv);
+void waitExec(int argc, char** argv);
+bool runShellCmd(char* input);
 void tokenizeString(struct Job* cmd_tok);
+bool parseProcSub(struct Job* cmd, uint32_t* tok_idx, uint8_t stage,
+		uint8_t redir);
+bool parseNumber(char* str, long min, long max, long* value);
+bool parseCpuList(char* list, cpu_set_t* cpus);
+bool parseDuration(char* str, uint64_t* ns);
+void parseSchedPrefix(struct Job* cmd, uint32_t* tok_idx);
+bool parseBraceSeq(struct BraceGroup* group);
+bool initBraces(struct BraceGen* gen, char* word);
+bool nextBrace(struct BraceGen* gen, char* buf);
+size_t argLimit();
+bool sizeArgs(char** argv, size_t limit, size_t* argc, size_t* bytes);
+char** expandArgs(char** argv);
 void parseJob(char* cmd_str, struct Job jobs_arr[], int* last_job);
+bool writeHereBuf(struct HereBuf* buf, const char* data, size_t len);
+bool openHereDoc(struct Job* cmd, char* word, uint8_t type, int* fd);
+bool openHereDocs(struct Job* cmd);
+void closeHereDocs(struct Job* cmd, uint8_t keep_stage);
 void redirectSimple(struct Job* cmd);
 void redirectPipe(struct Job* cmd);
+bool openProcSubs(struct Job* cmd, int peer_fds[]);
+void closeProcSubs(struct Job* cmd, int peer_fds[], uint8_t keep_stage);
+void runProcSubs(struct Job* cmd, int peer_fds[], int pfd[]);
+int setPipeSize(int fd, int size);
+void tunePipe(struct Job* cmd);
+void relayPipe(struct PipeMeter* meter, int in_fd, int out_fd);
+void runPipeMeter(struct Job* cmd, int pfd[], int mfd[], int peer_fds[]);
+void placeJob(struct Job* cmd);
+bool applySched(struct Job* cmd, uint8_t stage);
+int runZygoteStage(void* data);
+void runZygote(int sock);
+bool startZygote();
+void stopZygote();
+pid_t spawnZygote(struct Job* cmd, uint8_t stage, pid_t pgid, int fds[]);
+void armTimer();
+void swapTimers(int a, int b);
+void siftTimer(int heap_idx);
+void setJobDeadline(int job_idx, uint64_t deadline_ns);
+void clearJobDeadline(int job_idx);
+void expireJob(int job_idx);
+void addJobProc(struct Job* cmd, pid_t pid);
+bool signalJob(struct Job* cmd, int sig);
+void handleTimer(int fd, uint32_t events, void* data);
+int exitStatus(int status);
+void reapProcess(struct Job* cmd, pid_t pid, int status);
 void waitForChildren(struct Job* cmd);
 void runJob(struct Job jobs_arr[], int* last_job);
-void handleNewJob(char* input);
+bool redirectShell(int in_fd, int out_fd, int saved_fds[]);
+void restoreShell(int saved_fds[]);
+uint64_t hashLine(const char* line);
+char* rebasePlanPtr(char* ptr, struct Job* dst, struct Job* src);
+void copyPlan(struct Job* dst, struct Job* src);
+bool loadPlan(char* input, struct Job* job);
+void savePlan(char* input, struct Job* job);
+bool planJob(char* input, int job_idx);
+int handleNewJob(char* input, bool bg);
+bool reapJob(int job_idx);
 void maintainJobsTable();
 void killAllJobs();
+bool initEvents();
+bool addEventSource(int fd, uint32_t events, EventHandler handler, void* data);
+bool setEventSource(int fd, uint32_t events);
+void removeEventSource(int fd);
+bool runEvents(int timeout_ms);
+void queueClientReply(struct Client* client, char type, long value,
+		const char* data, size_t len);
+void updateClient(struct Client* client);
+void flushClient(struct Client* client);
+void closeClient(struct Client* client);
+void finishClientCmd(struct Client* client);
+void finishClientJob(int job_idx);
+void relayClientOutput(int fd, uint32_t events, void* data);
+void runClientCmd(struct Client* client, char* line);
+void processClient(struct Client* client);
+void handleClient(int fd, uint32_t events, void* data);
+void acceptClient(int fd, uint32_t events, void* data);
+void handleSignals(int fd, uint32_t events, void* data);
+int openServerSocket(char* path);
+int runServer(char* path);
+void runLine(char* in_str);
+void handleInput(char* in_str);
+void readInput(int fd, uint32_t events, void* data);
+bool isExecutable(const char* dir, const char* name);
+int cmpName(const void* a, const void* b);
+void scanExecDir(struct ExecDir* dir);
+size_t findName(char** names, size_t len, const char* name);
+void addExecName(char* name);
+void dropExecName(char* name);
+bool isBuiltinName(const char* name);
+void updateExecName(struct ExecDir* dir, const char* name);
+void handleExecWatch(int fd, uint32_t events, void* data);
+void resetExecDirs();
+void indexExecs();
+char* completeExecName(const char* text, int state);
+char** completeCommand(const char* text, int start, int end);
 int main(int argc, char** argv);
 
 #endif